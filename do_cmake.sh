@@ -10,10 +10,12 @@ make -j8
 cd ../..
 git clone git@github.com:facebook/zstd.git lib/zstd
 cd lib/zstd
-git checkout tags/v1.3.5 -b mbc-bench
+git checkout tags/v1.5.7 -b mbc-bench
 git apply ../../patches/zdict.patch
 make -j8
 cd ../..
 cp lib/lz4/lib/lz4.h include/
-cp lib/zstd/zstd.h include/
-cp lib/zstd/lib/dictBuilder/zdict.h include/
+cp lib/lz4/lib/lz4hc.h include/
+cp lib/zstd/lib/zstd.h include/
+cp lib/zstd/lib/zstd_errors.h include/
+cp lib/zstd/lib/zdict.h include/
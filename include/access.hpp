@@ -0,0 +1,156 @@
+#ifndef ACCESS_H
+#define ACCESS_H
+
+#include <cmath>
+#include <random>
+#include <iostream>
+#include "common.h"
+
+/* AccessPattern produces the block numbers a random-read workload visits, drawn from
+ * AccessParameter::distribution over [0, nBlocks). The same seed always gives the same sequence.
+ *  - UniformAccess: every block is equally likely.
+ *  - ZipfAccess: Zipfian popularity with exponent zipf_theta in (0, 1), using Gray et al.'s constant-time
+ *    sampler as in YCSB. Ranks are hashed onto blocks, so the popular blocks are spread over the file.
+ *  - HotColdAccess: hot_probability of the reads go to the first hot_fraction of the blocks.
+ *  - StridedAccess: start at a random block, then step stride blocks each read, wrapping at the end.
+ *  - SequentialAccess: runs of run_length consecutive blocks, each run starting at a random block.
+ */
+class AccessPattern {
+private:
+	AccessParameter _params;
+	long long int _number_of_blocks;
+	std::mt19937_64 _generator;
+	long long int _cursor; // next block of the current stride or run
+	int _run_left;
+	// constants of the Zipfian sampler
+	double _zeta_n;
+	double _alpha;
+	double _eta;
+	long long int nextUniform(long long int lo, long long int hi);
+	long long int nextZipf();
+	static double zeta(long long int n, double theta);
+	static long long int scramble(long long int rank);
+public:
+	AccessPattern(AccessParameter params, long long int nBlocks);
+	long long int next();
+};
+
+// uniform reads, one per block of the file, seeded with RANDOM_SEED and without warm-up
+inline AccessParameter defaultAccessParameter() {
+	AccessParameter params;
+	params.distribution = UniformAccess;
+	params.zipf_theta = ZIPF_THETA;
+	params.hot_fraction = HOT_FRACTION;
+	params.hot_probability = HOT_PROBABILITY;
+	params.stride = ACCESS_STRIDE;
+	params.run_length = RUN_LENGTH;
+	params.number_of_reads = 0;
+	params.warmup_reads = 0;
+	params.seed = RANDOM_SEED;
+	return params;
+}
+
+AccessPattern::AccessPattern(AccessParameter params, long long int nBlocks) : _generator(params.seed) {
+	_params = params;
+	_number_of_blocks = nBlocks > 0 ? nBlocks : 1;
+	_cursor = 0;
+	_run_left = 0;
+	_zeta_n = 0;
+	_alpha = 0;
+	_eta = 0;
+	if(_params.distribution == ZipfAccess) {
+		if(_params.zipf_theta <= 0 || _params.zipf_theta >= 1) {
+			std::cout << "WARNING: AccessPattern::AccessPattern, zipf_theta must be in (0, 1), use " << ZIPF_THETA << " instead" << std::endl;
+			_params.zipf_theta = ZIPF_THETA;
+		}
+		double theta = _params.zipf_theta;
+		_zeta_n = zeta(_number_of_blocks, theta);
+		_alpha = 1.0 / (1.0 - theta);
+		_eta = (1.0 - std::pow(2.0 / _number_of_blocks, 1.0 - theta)) / (1.0 - zeta(2, theta) / _zeta_n);
+	}
+	if(_params.distribution == HotColdAccess && (_params.hot_fraction <= 0 || _params.hot_fraction > 1)) {
+		std::cout << "WARNING: AccessPattern::AccessPattern, hot_fraction must be in (0, 1], use " << HOT_FRACTION << " instead" << std::endl;
+		_params.hot_fraction = HOT_FRACTION;
+	}
+	if(_params.distribution == StridedAccess) {
+		_cursor = nextUniform(0, _number_of_blocks - 1);
+	}
+	if(_params.run_length < 1) {
+		_params.run_length = 1;
+	}
+}
+
+long long int AccessPattern::nextUniform(long long int lo, long long int hi) {
+	std::uniform_int_distribution<long long int> distribution(lo, hi);
+	return distribution(_generator);
+}
+
+double AccessPattern::zeta(long long int n, double theta) {
+	double sum = 0;
+	for(long long int i = 1; i <= n; ++i) {
+		sum += 1.0 / std::pow((double) i, theta);
+	}
+	return sum;
+}
+
+long long int AccessPattern::scramble(long long int rank) {
+	/* FNV-1a over the bytes of rank */
+	unsigned long long int hash = 14695981039346656037ULL;
+	for(int i = 0; i < 8; ++i) {
+		hash ^= (rank >> (i * 8)) & 0xff;
+		hash *= 1099511628211ULL;
+	}
+	return (long long int) (hash >> 1);
+}
+
+long long int AccessPattern::nextZipf() {
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	double u = distribution(_generator);
+	double uz = u * _zeta_n;
+	long long int rank = 0;
+	if(uz < 1.0) {
+		rank = 0;
+	} else if(uz < 1.0 + std::pow(0.5, _params.zipf_theta)) {
+		rank = 1;
+	} else {
+		rank = (long long int) (_number_of_blocks * std::pow(_eta * u - _eta + 1.0, _alpha));
+	}
+	if(rank >= _number_of_blocks) {
+		rank = _number_of_blocks - 1;
+	}
+	return scramble(rank) % _number_of_blocks;
+}
+
+long long int AccessPattern::next() {
+	long long int block = 0;
+	if(_params.distribution == ZipfAccess) {
+		block = nextZipf();
+	} else if(_params.distribution == HotColdAccess) {
+		long long int hotBlocks = (long long int) (_params.hot_fraction * _number_of_blocks);
+		if(hotBlocks < 1) {
+			hotBlocks = 1;
+		}
+		std::uniform_real_distribution<double> distribution(0.0, 1.0);
+		if(hotBlocks >= _number_of_blocks || distribution(_generator) < _params.hot_probability) {
+			block = nextUniform(0, hotBlocks - 1);
+		} else {
+			block = nextUniform(hotBlocks, _number_of_blocks - 1);
+		}
+	} else if(_params.distribution == StridedAccess) {
+		block = _cursor;
+		_cursor = ((_cursor + _params.stride) % _number_of_blocks + _number_of_blocks) % _number_of_blocks;
+	} else if(_params.distribution == SequentialAccess) {
+		if(_run_left == 0) {
+			_cursor = nextUniform(0, _number_of_blocks - 1);
+			_run_left = _params.run_length;
+		}
+		block = _cursor;
+		_cursor = (_cursor + 1) % _number_of_blocks;
+		_run_left--;
+	} else {
+		block = nextUniform(0, _number_of_blocks - 1);
+	}
+	return block;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include "common.h"
+
+/* StripeCache keeps one buffer per stripe index: the decoded stripe for SBC/MBC, or the dictionary and
+ * entry table of a RAC stripe. The total size of the buffers is kept within a byte budget. When an insert
+ * does not fit, entries are evicted in least-recently-used order (LRUCache) or in insertion order (FIFOCache).
+ * It is not thread-safe; each reading loop owns its own cache.
+ */
+class StripeCache {
+private:
+	struct Entry {
+		int stripe_idx;
+		char* data;
+		int size;
+	};
+	long long int _capacity;
+	long long int _size;
+	CachePolicy _policy;
+	std::list<Entry> _entries; // front is evicted last
+	std::unordered_map<int, std::list<Entry>::iterator> _index;
+	long long int _hits;
+	long long int _misses;
+	void evictOne();
+public:
+	StripeCache(long long int capacity, CachePolicy policy);
+	virtual ~StripeCache();
+	// return the decoded stripe and set *size, or NULL on a miss
+	const char* lookup(int stripeIdx, int* size);
+	// reserve a size-byte buffer for stripeIdx that the caller decodes into; NULL if size exceeds the capacity
+	char* insert(int stripeIdx, int size);
+	// drop stripeIdx, e.g. when decoding into the buffer returned by insert failed
+	void erase(int stripeIdx);
+	void clear();
+	// zero the hit and miss counters but keep the cached stripes, e.g. at the end of a warm-up
+	void resetCounters();
+	long long int getHits();
+	long long int getMisses();
+	long long int getSize();
+};
+
+StripeCache::StripeCache(long long int capacity, CachePolicy policy) {
+	_capacity = capacity;
+	_size = 0;
+	_policy = policy;
+	_hits = 0;
+	_misses = 0;
+}
+
+StripeCache::~StripeCache() {
+	clear();
+}
+
+void StripeCache::evictOne() {
+	Entry& e = _entries.back();
+	_size -= e.size;
+	_index.erase(e.stripe_idx);
+	delete [] e.data;
+	_entries.pop_back();
+}
+
+const char* StripeCache::lookup(int stripeIdx, int* size) {
+	std::unordered_map<int, std::list<Entry>::iterator>::iterator it = _index.find(stripeIdx);
+	if(it == _index.end()) {
+		_misses++;
+		return NULL;
+	}
+	_hits++;
+	if(_policy == LRUCache) {
+		_entries.splice(_entries.begin(), _entries, it->second);
+	}
+	*size = it->second->size;
+	return it->second->data;
+}
+
+char* StripeCache::insert(int stripeIdx, int size) {
+	if(size > _capacity) {
+		return NULL;
+	}
+	erase(stripeIdx);
+	while(_size + size > _capacity) {
+		evictOne();
+	}
+	Entry e = {stripeIdx, new char[size], size};
+	_entries.push_front(e);
+	_index[stripeIdx] = _entries.begin();
+	_size += size;
+	return e.data;
+}
+
+void StripeCache::erase(int stripeIdx) {
+	std::unordered_map<int, std::list<Entry>::iterator>::iterator it = _index.find(stripeIdx);
+	if(it == _index.end()) {
+		return;
+	}
+	_size -= it->second->size;
+	delete [] it->second->data;
+	_entries.erase(it->second);
+	_index.erase(it);
+}
+
+void StripeCache::clear() {
+	while(!_entries.empty()) {
+		evictOne();
+	}
+}
+
+void StripeCache::resetCounters() {
+	_hits = 0;
+	_misses = 0;
+}
+
+long long int StripeCache::getHits() {
+	return _hits;
+}
+
+long long int StripeCache::getMisses() {
+	return _misses;
+}
+
+long long int StripeCache::getSize() {
+	return _size;
+}
+
+#endif
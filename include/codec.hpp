@@ -0,0 +1,147 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <iostream>
+#include "common.h"
+#include "lz4.h"
+#include "lz4hc.h"
+#include "zstd.h"
+
+/* A codec traits class gives the SBC/MBC/RAC compressors and decompressors everything they need from a block
+ * codec. The classes are templates on it, so every call below is resolved at compile time.
+ *  - CCtx: compression state owned by one compressor (createCCtx/freeCCtx)
+ *  - bound, compress, decompress: whole buffers; compress returns 0 and decompress a negative value on error
+ *  - decompressPrefix: decode at least targetSize bytes from the start, or everything if the codec cannot stop early
+ *  - CDict/DDict: a dictionary prepared once per RAC stripe for compressing/decoding its blocks; either may be NULL
+ * The compression calls take the CompressionParameter so that each codec reads its own knobs (level, acceleration).
+ * To add a codec, write a traits class and add it to Compressor::create, Decompressor::create and
+ * Compressor::compressBound.
+ */
+struct LZ4CodecTraits {
+	typedef LZ4_stream_t CCtx;
+	struct CDict {
+		const char* dict;
+		int dictSize;
+	};
+	struct DDict {};
+	static const Codec codec = LZ4Codec;
+
+	static CCtx* createCCtx() { return LZ4_createStream(); }
+	static void freeCCtx(CCtx* cctx) { LZ4_freeStream(cctx); }
+	static int bound(int srcSize) { return LZ4_compressBound(srcSize); }
+	static int compress(CCtx* cctx, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		return LZ4_compress_fast(src, dst, srcSize, dstCapacity, params.acceleration);
+	}
+	static int decompress(const char* src, int srcSize, char* dst, int dstCapacity) {
+		return LZ4_decompress_safe(src, dst, srcSize, dstCapacity);
+	}
+	// LZ4 sequences only refer backwards, so decoding stops once targetSize bytes have been produced
+	static int decompressPrefix(const char* src, int srcSize, char* dst, int targetSize, int dstCapacity) {
+		return LZ4_decompress_safe_partial(src, dst, srcSize, targetSize, dstCapacity);
+	}
+	static CDict* createCDict(const char* dict, int dictSize, const CompressionParameter& params) {
+		CDict* cdict = new CDict;
+		cdict->dict = dict;
+		cdict->dictSize = dictSize;
+		return cdict;
+	}
+	static void freeCDict(CDict* cdict) { delete cdict; }
+	static int compressUsingCDict(CCtx* cctx, const CDict* cdict, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		LZ4_loadDict(cctx, cdict ? cdict->dict : NULL, cdict ? cdict->dictSize : 0);
+		return LZ4_compress_fast_continue(cctx, src, dst, srcSize, dstCapacity, params.acceleration);
+	}
+	static DDict* createDDict(const char* dict, int dictSize) { return NULL; }
+	static void freeDDict(DDict* ddict) {}
+	static int decompressUsingDict(const char* src, int srcSize, char* dst, int dstCapacity, const char* dict, int dictSize, const DDict* ddict) {
+		return LZ4_decompress_safe_usingDict(src, dst, srcSize, dstCapacity, dict, dictSize);
+	}
+};
+
+/* LZ4HC writes ordinary LZ4 blocks, so only the compression side differs from LZ4CodecTraits; level is the HC
+ * level and 0 uses LZ4HC_CLEVEL_DEFAULT.
+ */
+struct LZ4HCCodecTraits : public LZ4CodecTraits {
+	typedef LZ4_streamHC_t CCtx;
+	static const Codec codec = LZ4HCCodec;
+
+	static CCtx* createCCtx() { return LZ4_createStreamHC(); }
+	static void freeCCtx(CCtx* cctx) { LZ4_freeStreamHC(cctx); }
+	static int compress(CCtx* cctx, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		return LZ4_compress_HC_extStateHC(cctx, src, dst, srcSize, dstCapacity, params.level);
+	}
+	static int compressUsingCDict(CCtx* cctx, const CDict* cdict, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		LZ4_resetStreamHC(cctx, params.level);
+		if(cdict) {
+			LZ4_loadDictHC(cctx, cdict->dict, cdict->dictSize);
+		}
+		return LZ4_compress_HC_continue(cctx, src, dst, srcSize, dstCapacity);
+	}
+};
+
+// owns the calling thread's zstd decompression context
+struct ZSTDContextHolder {
+	ZSTD_DCtx* dctx;
+	ZSTDContextHolder() : dctx(NULL) {}
+	~ZSTDContextHolder() {
+		if(dctx) {
+			ZSTD_freeDCtx(dctx);
+		}
+	}
+};
+
+struct ZSTDCodecTraits {
+	typedef ZSTD_CCtx CCtx;
+	typedef ZSTD_CDict CDict;
+	typedef ZSTD_DDict DDict;
+	static const Codec codec = ZSTDCodec;
+
+	/* One Decompressor serves every reader thread of a CompressedFileReader, so it keeps no zstd context of its
+	 * own; each thread reuses the context returned here for all its calls.
+	 */
+	static ZSTD_DCtx* threadDCtx() {
+		static thread_local ZSTDContextHolder holder;
+		if(!holder.dctx) {
+			holder.dctx = ZSTD_createDCtx();
+		}
+		return holder.dctx;
+	}
+	static int result(size_t ret, int error) {
+		return ZSTD_isError(ret) ? error : (int) ret;
+	}
+
+	static CCtx* createCCtx() { return ZSTD_createCCtx(); }
+	static void freeCCtx(CCtx* cctx) { ZSTD_freeCCtx(cctx); }
+	static int bound(int srcSize) { return ZSTD_compressBound(srcSize); }
+	static int compress(CCtx* cctx, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		return result(ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, params.level), 0);
+	}
+	static int decompress(const char* src, int srcSize, char* dst, int dstCapacity) {
+		return result(ZSTD_decompressDCtx(threadDCtx(), dst, dstCapacity, src, srcSize), -1);
+	}
+	// zstd has no partial decoding, so the whole frame is decoded
+	static int decompressPrefix(const char* src, int srcSize, char* dst, int targetSize, int dstCapacity) {
+		return decompress(src, srcSize, dst, dstCapacity);
+	}
+	static CDict* createCDict(const char* dict, int dictSize, const CompressionParameter& params) {
+		return dictSize > 0 ? ZSTD_createCDict(dict, dictSize, params.level) : NULL;
+	}
+	static void freeCDict(CDict* cdict) { ZSTD_freeCDict(cdict); }
+	static int compressUsingCDict(CCtx* cctx, const CDict* cdict, const char* src, int srcSize, char* dst, int dstCapacity, const CompressionParameter& params) {
+		if(!cdict) {
+			return compress(cctx, src, srcSize, dst, dstCapacity, params);
+		}
+		return result(ZSTD_compress_usingCDict(cctx, dst, dstCapacity, src, srcSize, cdict), 0);
+	}
+	static DDict* createDDict(const char* dict, int dictSize) {
+		return dictSize > 0 ? ZSTD_createDDict(dict, dictSize) : NULL;
+	}
+	static void freeDDict(DDict* ddict) { ZSTD_freeDDict(ddict); }
+	static int decompressUsingDict(const char* src, int srcSize, char* dst, int dstCapacity, const char* dict, int dictSize, const DDict* ddict) {
+		if(ddict) {
+			return result(ZSTD_decompress_usingDDict(threadDCtx(), dst, dstCapacity, src, srcSize, ddict), -1);
+		}
+		return result(ZSTD_decompress_usingDict(threadDCtx(), dst, dstCapacity, src, srcSize, dict, dictSize), -1);
+	}
+};
+
+#endif
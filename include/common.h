@@ -3,8 +3,10 @@
 
 #include <chrono>
 #include <iostream>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
+#include "histogram.hpp"
 
 #define SBC_BLOCK_SIZE 4096
 #define SBC_NUMBER_OF_BLOCKS 1
@@ -16,12 +18,132 @@
 #define RAC_K 64
 #define RAC_D 8
 #define BUFFER_SIZE 1048576
+#define NUMBER_OF_THREADS 1
+#define TARGET_QPS 0
+#define CACHE_SIZE 0
+#define ZIPF_THETA 0.99
+#define HOT_FRACTION 0.2
+#define HOT_PROBABILITY 0.8
+#define ACCESS_STRIDE 1
+#define RUN_LENGTH 16
+#define RANDOM_SEED 1
+#define COMPRESSION_LEVEL 0
+#define LZ4_ACCELERATION 1
+#define SHARED_DICTIONARIES 0
+#define SHARED_DICT_SAMPLE_RATIO 100 // bytes sampled to train a shared dictionary, per byte of max_dict
+#define DICT_DRIFT 0
+#define DICT_DEDUP 0
+#define DICT_DRIFT_RUN 8 // stripes in a run that reuses dictionaries across stripes; runs go whole to one thread
+#define DICT_THREADS 1
+#define FASTCOVER_F 20
+#define FASTCOVER_ACCEL 1
+#define DICT_SAMPLE_FRACTION 1
+#define DICT_SAMPLE_BLOCKS 0
+#define DICT_BUDGET_MS 0
+#define DICT_PROBE_BLOCKS 4 // blocks of a stripe compressed to check whether the previous dictionary still fits
 
 #define DEFAULT_BlockSize SBC_BLOCK_SIZE
 #define DEFAULT_NumberOfBlocks SBC_NUMBER_OF_BLOCKS
 #define DEFAULT_MaxDict RAC_MAX_DICT
 #define DEFAULT_KmerSize RAC_D
 #define DEFAULT_SegmentSize RAC_K
+#define DEFAULT_NumberOfThreads NUMBER_OF_THREADS
+#define DEFAULT_TargetQPS TARGET_QPS
+#define DEFAULT_CacheSize CACHE_SIZE
+#define DEFAULT_ZipfTheta ZIPF_THETA
+#define DEFAULT_HotFraction HOT_FRACTION
+#define DEFAULT_HotProbability HOT_PROBABILITY
+#define DEFAULT_Stride ACCESS_STRIDE
+#define DEFAULT_RunLength RUN_LENGTH
+#define DEFAULT_Seed RANDOM_SEED
+#define DEFAULT_Level COMPRESSION_LEVEL
+#define DEFAULT_Acceleration LZ4_ACCELERATION
+#define DEFAULT_SharedDictionaries SHARED_DICTIONARIES
+#define DEFAULT_DictDrift DICT_DRIFT
+#define DEFAULT_DictDedup DICT_DEDUP
+
+/* Build with -DMBC_ENABLE_STATS=0 to compile every per-call timer and latency histogram out of the hot paths.
+ * Sizes and the workload-level results (throughput, open-loop latency) are still reported.
+ */
+#ifndef MBC_ENABLE_STATS
+#define MBC_ENABLE_STATS 1
+#endif
+
+#if MBC_ENABLE_STATS
+#define STATS_NOW(t) std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now()
+#define STATS_ADD_TIME(timer, t_start, t_end) gStats.local().timer += (t_end) - (t_start)
+#define STATS_RECORD_LATENCY(histogram, t_start, t_end) gStats.local().histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>((t_end) - (t_start)).count())
+#else
+#define STATS_NOW(t) (void)0
+#define STATS_ADD_TIME(timer, t_start, t_end) (void)0
+#define STATS_RECORD_LATENCY(histogram, t_start, t_end) (void)0
+#endif
+
+// per-thread result of the concurrent random-read workload
+struct ReadThreadStats {
+	int thread;
+	long long int reads;
+	long long int bytes;
+	std::chrono::duration<double> latency_sum;
+	std::chrono::duration<double> latency_max;
+};
+
+// the counters one thread updates without synchronization; ZZStats::collect sums the shards of all threads
+struct StatsShard {
+	std::chrono::steady_clock::duration compression_timer;
+	std::chrono::steady_clock::duration decompression_timer;
+	std::chrono::steady_clock::duration dictionary_timer;
+	long long int total_dictionary_size;
+	// RAC stripes compressed with the dictionary of the previous stripe, and stripes that trained their own
+	long long int dict_reused_stripes;
+	long long int dict_retrained_stripes;
+	// RAC stripes whose training overran the time budget
+	long long int dict_budget_overruns;
+	// MBC block reads and the sum over them of the fraction of the stripe that was decoded
+	long long int mbc_block_decodes;
+	double mbc_decoded_fraction;
+	LatencyHistogram compress_stripe_histogram;
+	LatencyHistogram generate_dict_histogram;
+	LatencyHistogram decompress_stripe_histogram;
+	LatencyHistogram decompress_block_histogram;
+
+	StatsShard() : compression_timer(0), decompression_timer(0), dictionary_timer(0), total_dictionary_size(0), dict_reused_stripes(0), dict_retrained_stripes(0), dict_budget_overruns(0), mbc_block_decodes(0), mbc_decoded_fraction(0) {}
+
+	void merge(const StatsShard& other) {
+		compression_timer += other.compression_timer;
+		decompression_timer += other.decompression_timer;
+		dictionary_timer += other.dictionary_timer;
+		total_dictionary_size += other.total_dictionary_size;
+		dict_reused_stripes += other.dict_reused_stripes;
+		dict_retrained_stripes += other.dict_retrained_stripes;
+		dict_budget_overruns += other.dict_budget_overruns;
+		mbc_block_decodes += other.mbc_block_decodes;
+		mbc_decoded_fraction += other.mbc_decoded_fraction;
+		compress_stripe_histogram.merge(other.compress_stripe_histogram);
+		generate_dict_histogram.merge(other.generate_dict_histogram);
+		decompress_stripe_histogram.merge(other.decompress_stripe_histogram);
+		decompress_block_histogram.merge(other.decompress_block_histogram);
+	}
+
+	// forget the decompression-side counters, e.g. those of a warm-up phase
+	void resetDecompression() {
+		decompression_timer = std::chrono::steady_clock::duration(0);
+		mbc_block_decodes = 0;
+		mbc_decoded_fraction = 0;
+		decompress_stripe_histogram.reset();
+		decompress_block_histogram.reset();
+	}
+};
+
+struct ZZStats;
+
+// owns the calling thread's shard and folds it into its ZZStats when the thread exits
+struct StatsShardHolder {
+	ZZStats* owner;
+	StatsShard* shard;
+	StatsShardHolder() : owner(NULL), shard(NULL) {}
+	~StatsShardHolder();
+};
 
 struct ZZStats {
 	std::chrono::duration<double> compression_timer;
@@ -31,6 +153,34 @@ struct ZZStats {
 	long long int total_raw_size;
 	long long int total_compressed_size;
 	long long int total_decompressed_size;
+	// bytes of RAC stripe dictionaries not written because an identical one was already stored
+	long long int total_deduplicated_dictionary_size;
+	// wall-clock time, blocks and bytes served by the concurrent random-read workload
+	std::chrono::duration<double> read_wall_timer;
+	long long int total_read_blocks;
+	long long int total_read_bytes;
+	std::vector<ReadThreadStats> read_threads;
+	// decoded-stripe cache of the random-read workload, and bytes the decoder produced vs. bytes handed to the caller
+	long long int cache_hits;
+	long long int cache_misses;
+	long long int total_decoded_bytes;
+	long long int total_served_bytes;
+	// bytes fetched from the compressed file by the random-read workload
+	long long int total_io_bytes;
+	// filled in by collect() from the shards
+	long long int dict_reused_stripes;
+	long long int dict_retrained_stripes;
+	long long int dict_budget_overruns;
+	long long int mbc_block_decodes;
+	double mbc_decoded_fraction;
+	// response times of the open-loop random-read workload, measured from each request's intended start,
+	// or of every operation of a replayed trace
+	LatencyHistogram read_latency_histogram;
+	// per-call latency of the compression/decompression entry points
+	LatencyHistogram compress_stripe_histogram;
+	LatencyHistogram generate_dict_histogram;
+	LatencyHistogram decompress_stripe_histogram;
+	LatencyHistogram decompress_block_histogram;
 	int n_stripes;
 	// hashmap to map stripe index to dictionary size
 	std::unordered_map<int, std::vector<int> > dictionary_map;
@@ -38,24 +188,162 @@ struct ZZStats {
 	std::unordered_map<int, std::vector<int> > block_raw_map;
 	// hashmap to map stripe index to compressed block size
 	std::unordered_map<int, std::vector<int> > block_compressed_map;
+	// shards of running threads, and the sum of the shards of threads that already exited
+	std::vector<StatsShard*> live_shards;
+	StatsShard retired_shards;
+	std::mutex shard_lock;
+
+	~ZZStats() {
+		for(int i = 0; i < live_shards.size(); ++i) {
+			delete live_shards[i];
+		}
+	}
+
+	// the calling thread's shard; only the first call of each thread takes shard_lock
+	StatsShard& local() {
+		static thread_local StatsShardHolder holder;
+		if(!holder.shard) {
+			holder.owner = this;
+			holder.shard = new StatsShard();
+			std::lock_guard<std::mutex> guard(shard_lock);
+			live_shards.push_back(holder.shard);
+		}
+		return *holder.shard;
+	}
+
+	void retire(StatsShard* shard) {
+		std::lock_guard<std::mutex> guard(shard_lock);
+		retired_shards.merge(*shard);
+		for(int i = 0; i < live_shards.size(); ++i) {
+			if(live_shards[i] == shard) {
+				live_shards.erase(live_shards.begin() + i);
+				break;
+			}
+		}
+		delete shard;
+	}
+
+	/* Sum every shard into the timers, dictionary size and per-call histograms above. Call it once the
+	 * worker threads have been joined; shards of threads that are still running are read without locking.
+	 */
+	void collect() {
+		std::lock_guard<std::mutex> guard(shard_lock);
+		StatsShard total = retired_shards;
+		for(int i = 0; i < live_shards.size(); ++i) {
+			total.merge(*live_shards[i]);
+		}
+		compression_timer = total.compression_timer;
+		decompression_timer = total.decompression_timer;
+		dictionary_timer = total.dictionary_timer;
+		total_dictionary_size = total.total_dictionary_size;
+		dict_reused_stripes = total.dict_reused_stripes;
+		dict_retrained_stripes = total.dict_retrained_stripes;
+		dict_budget_overruns = total.dict_budget_overruns;
+		mbc_block_decodes = total.mbc_block_decodes;
+		mbc_decoded_fraction = total.mbc_decoded_fraction;
+		compress_stripe_histogram = total.compress_stripe_histogram;
+		generate_dict_histogram = total.generate_dict_histogram;
+		decompress_stripe_histogram = total.decompress_stripe_histogram;
+		decompress_block_histogram = total.decompress_block_histogram;
+	}
 
 	void print() {
+		collect();
 		std::cout << "Time for generating dictionary (CPU):" << dictionary_timer.count() << std::endl;
 		std::cout << "Time for compression (CPU):" << compression_timer.count() << std::endl;
 		std::cout << "Time for decompression (CPU):" << decompression_timer.count() << std::endl;
 		std::cout << "Dictionary Size: " << total_dictionary_size << std::endl;
+		std::cout << "Deduplicated Dictionary Size: " << total_deduplicated_dictionary_size << std::endl;
 		std::cout << "Raw Data Size: " << total_raw_size << std::endl;
 		std::cout << "Compressed Data Size: " << total_compressed_size << std::endl;
 		std::cout << "Decompressed Data Size: " << total_decompressed_size << std::endl;
+		if(total_read_blocks > 0) {
+			std::cout << "Read Throughput (blocks/s): " << read_blocks_per_second() << std::endl;
+			std::cout << "Read Throughput (MB/s): " << read_mb_per_second() << std::endl;
+		}
+		if(total_served_bytes > 0) {
+			std::cout << "Stripe Cache Hit Ratio: " << cache_hit_ratio() << std::endl;
+			std::cout << "Bytes Decoded per Byte Served: " << decode_amplification() << std::endl;
+			std::cout << "Bytes Read per Byte Served: " << io_amplification() << std::endl;
+		}
+		if(dict_reused_stripes > 0) {
+			std::cout << "RAC Stripes on a Reused/Retrained Dictionary: " << dict_reused_stripes << "/" << dict_retrained_stripes << std::endl;
+		}
+		if(dict_budget_overruns > 0) {
+			std::cout << "RAC Stripes over the Training Budget: " << dict_budget_overruns << std::endl;
+		}
+		if(mbc_block_decodes > 0) {
+			std::cout << "Average Fraction of MBC Stripe Decoded: " << mbc_average_decoded_fraction() << std::endl;
+		}
+		if(read_latency_histogram.count() > 0) {
+			std::cout << "Read Latency p50/p90/p99/p99.9 (us): " << read_latency_percentile(50) * 1e6 << "/" << read_latency_percentile(90) * 1e6
+				<< "/" << read_latency_percentile(99) * 1e6 << "/" << read_latency_percentile(99.9) * 1e6 << std::endl;
+		}
+		print_histogram("compressStripe", compress_stripe_histogram);
+		print_histogram("generateDict", generate_dict_histogram);
+		print_histogram("decompressStripe", decompress_stripe_histogram);
+		print_histogram("decompressBlock", decompress_block_histogram);
+	}
+
+	void print_histogram(std::string name, const LatencyHistogram& histogram) {
+		if(histogram.count() > 0) {
+			std::cout << name << " Latency p50/p99/p99.9/max (us): " << histogram.percentile(50) / 1e3 << "/" << histogram.percentile(99) / 1e3
+				<< "/" << histogram.percentile(99.9) / 1e3 << "/" << histogram.max() / 1e3 << std::endl;
+		}
+	}
+
+	double read_blocks_per_second() {
+		return read_wall_timer.count() > 0 ? total_read_blocks / read_wall_timer.count() : 0;
+	}
+
+	double cache_hit_ratio() {
+		return cache_hits + cache_misses > 0 ? (double) cache_hits / (cache_hits + cache_misses) : 0;
+	}
+
+	double decode_amplification() {
+		return total_served_bytes > 0 ? (double) total_decoded_bytes / total_served_bytes : 0;
+	}
+
+	// average fraction of an MBC stripe decoded to serve one block
+	double mbc_average_decoded_fraction() {
+		return mbc_block_decodes > 0 ? mbc_decoded_fraction / mbc_block_decodes : 0;
+	}
+
+	double io_amplification() {
+		return total_served_bytes > 0 ? (double) total_io_bytes / total_served_bytes : 0;
+	}
+
+	double read_mb_per_second() {
+		return read_wall_timer.count() > 0 ? total_read_bytes / read_wall_timer.count() / (1024*1024) : 0;
+	}
+
+	// percentile p in [0, 100] of the open-loop response times, in seconds
+	double read_latency_percentile(double p) {
+		return read_latency_histogram.percentile(p) / 1e9;
 	}
 };
 
 extern ZZStats gStats;
 
+inline StatsShardHolder::~StatsShardHolder() {
+	if(owner && shard) {
+		owner->retire(shard);
+	}
+}
+
 enum Workload {
 	RandomRead,
+	ConcurrentRandomRead,
 	SequentialRead,
-	SequentialWrite
+	SequentialWrite,
+	TraceReplay
+};
+
+// how the random-read workload fetches compressed stripes
+enum IOEngine {
+	StdioEngine,
+	MmapEngine,
+	PreadEngine
 };
 
 enum CompressionAlgorithm {
@@ -64,15 +352,129 @@ enum CompressionAlgorithm {
 	RAC
 };
 
+// block codec used by every compression algorithm
+enum Codec {
+	LZ4Codec,
+	ZSTDCodec,
+	LZ4HCCodec // LZ4 blocks produced by the high-compression encoder
+};
+
+// how RAC trains the dictionary of a stripe: COVER's rolling k-mers, the legacy suffix-array trainer or the in-tree k-mer builder
+enum DictionaryAlgorithm {
+	RollingKmer,
+	SuffixArray,
+	FastCover, // needs zstd 1.3.6 or later; falls back to RollingKmer otherwise
+	NativeKmer // KmerDictionaryBuilder (see kmerdict.hpp)
+};
+
+// which blocks of a stripe the RAC trainer samples
+enum SampleSelection {
+	StrideSampling, // evenly spaced
+	RandomSampling
+};
+
+// what a RAC stripe is compressed with when training it overruns the time budget
+enum BudgetFallback {
+	NoDictionary,
+	PreviousDictionary // the dictionary of the stripe before, or none for the first one
+};
+
+// knobs of the RAC dictionary trainers; unlike CompressionParameter they are not recorded in the file
+struct TrainerParameter {
+	int threads; // threads of the zstd optimizer, which tries its candidate (k, d) pairs in parallel
+	int f; // FastCover: log2 of the size of its k-mer frequency table, in [0, 31]; 0 uses zstd's default
+	int accel; // FastCover: speed over accuracy of its frequency sampling, in [0, 10]; 0 uses zstd's default
+	double sample_fraction; // fraction of the blocks of a stripe the trainer samples, in (0, 1]
+	int sample_blocks; // number of blocks sampled instead of sample_fraction, when > 0
+	SampleSelection sampling;
+	double budget_ms; // milliseconds a stripe waits for its dictionary before falling back; 0 always waits
+	BudgetFallback fallback;
+};
+
+inline TrainerParameter defaultTrainerParameter() {
+	TrainerParameter trainer;
+	trainer.threads = DICT_THREADS;
+	trainer.f = FASTCOVER_F;
+	trainer.accel = FASTCOVER_ACCEL;
+	trainer.sample_fraction = DICT_SAMPLE_FRACTION;
+	trainer.sample_blocks = DICT_SAMPLE_BLOCKS;
+	trainer.sampling = StrideSampling;
+	trainer.budget_ms = DICT_BUDGET_MS;
+	trainer.fallback = NoDictionary;
+	return trainer;
+}
+
+// eviction order of the decoded-stripe cache
+enum CachePolicy {
+	LRUCache,
+	FIFOCache
+};
+
+// inter-arrival distribution of the open-loop random-read workload
+enum ArrivalProcess {
+	ConstantArrival,
+	PoissonArrival
+};
+
+// which blocks the random-read workloads visit, see AccessPattern
+enum AccessDistribution {
+	UniformAccess,
+	ZipfAccess,
+	HotColdAccess,
+	StridedAccess,
+	SequentialAccess
+};
+
+struct AccessParameter {
+	AccessDistribution distribution;
+	double zipf_theta;
+	double hot_fraction; // fraction of the blocks in the hot set
+	double hot_probability; // fraction of the reads that go to the hot set
+	long long int stride;
+	int run_length;
+	long long int number_of_reads; // measured reads; 0 reads as many blocks as the file has
+	long long int warmup_reads; // reads issued before measuring, not reported
+	unsigned int seed;
+};
+
+// whether the offset and length columns of a trace are bytes or blocks
+enum TraceUnit {
+	ByteTrace,
+	BlockTrace
+};
+
+// issue the reads of a trace back to back, or at their recorded timestamps
+enum ReplayMode {
+	FastReplay,
+	TimedReplay
+};
+
 struct GlobalParams {
 	CompressionAlgorithm algorithm;
+	Codec codec;
+	int level;
+	int acceleration;
 	int block_size;
 	int number_of_blocks;
 	int max_dict;
 	int kmer_size;
 	int segment_size;
 	Workload workload;
-	std::string dictionary_algorithm;
+	DictionaryAlgorithm dictionary_algorithm;
+	int shared_dictionaries; // RAC dictionaries trained for the whole file; 0 trains one per stripe
+	TrainerParameter trainer;
+	double dictionary_drift; // RAC keeps the previous stripe's dictionary until a probe compresses this fraction worse; 0 trains one per stripe
+	bool dictionary_dedup; // RAC stores identical stripe dictionaries once, after the payload; false keeps every stripe self-contained
+	int number_of_threads;
+	IOEngine io_engine;
+	double target_qps;
+	ArrivalProcess arrival;
+	long long int cache_size;
+	CachePolicy cache_policy;
+	AccessParameter access;
+	std::string trace_name;
+	TraceUnit trace_unit;
+	ReplayMode replay_mode;
 };
 
 enum StreamState {
@@ -89,6 +491,9 @@ struct CompressionParameter {
 	int max_dict;
 	int k; // segment size for rolling kmers
 	int d; // k-mer size for rolling kmers
+	Codec codec;
+	int level; // compression level of zstd and LZ4HC; 0 uses the codec's default
+	int acceleration; // LZ4 acceleration, trading ratio for speed; values below 1 use 1
 };
 
 struct StripeHeader {
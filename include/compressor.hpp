@@ -1,131 +1,436 @@
 #ifndef COMPRESSOR_H
 #define COMPRESSOR_H
 
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <random>
 #include <vector>
 #include <iostream>
 #include "common.h"
-#include "lz4.h"
+#include "codec.hpp"
+#include "kmerdict.hpp"
 #include "zdict.h"
-#include "zstd.h"
 
+/* Compressor is the interface Filer sees; it is called once per stripe. The SBC/MBC/RAC compressors are templates
+ * on a codec traits class (see codec.hpp), so the codec calls inside a stripe are bound at compile time.
+ * Compressor::create picks the instantiation from the algorithm and params.codec.
+ */
 class Compressor {
 protected:
 	bool _mbc_enable;
 	bool _rac_enable;
 	CompressionAlgorithm _algorithm;
 	CompressionParameter _params;
-	LZ4_stream_t* _stream;
 public:
 	Compressor(CompressionParameter params);
 	virtual ~Compressor();
+	// a compressor for algorithm with the codec of params, NULL if either is unknown
+	static Compressor* create(CompressionAlgorithm algorithm, CompressionParameter params);
+	// worst-case compressed size of srcSize bytes with the codec of params
+	static int compressBound(CompressionParameter params, int srcSize);
 	// return 0 when it is compressed and dstSize is the size of compressed data, return 1 when compressed data is larger than uncompressed data.
-	virtual int compressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, std::string dictAlgm = "rolling-kmer");
+	virtual int compressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, DictionaryAlgorithm dictAlgm = RollingKmer) = 0;
+	/* Compress the following stripes against file-level dictionary id, whose dictSize bytes at dict stay valid
+	 * while it is in use, instead of training one per stripe; a negative id goes back to per-stripe training.
+	 * Only RAC uses dictionaries.
+	 */
+	virtual void useSharedDictionary(int id, const char* dict, int dictSize);
+	/* Keep compressing with the dictionary of the previous stripe until a probe of the next stripe compresses more
+	 * than threshold (a fraction) worse than that dictionary did on its own stripe, then train a new one; 0 trains
+	 * one per stripe. Forgets any dictionary kept so far. Only RAC uses dictionaries; the others ignore it.
+	 */
+	virtual void setDictionaryDrift(double threshold);
+	// threads and FastCover knobs of the dictionary trainer; the algorithm is chosen per call of compressStripe
+	virtual void setTrainerParameter(TrainerParameter trainer);
+	/* Called before compressing stripe stripeIdx of the file. runStart marks the first stripe of a run that one
+	 * compressor compresses in order; RAC drops the drift dictionary kept from the previous run there, so the
+	 * output does not depend on which thread got which run. The dictionary a stripe over its training budget
+	 * falls back on is kept, since when a budget runs out depends on timing anyway.
+	 */
+	virtual void beginStripe(int stripeIdx, bool runStart);
 };
 
-class SBCCompressor : public Compressor {
+/* Train a dictionary of at most dictCapacity bytes from the samples laid out back to back at samples, with
+ * the sizes in sampleSizes. A segment size (params.k) or k-mer size (params.d) of 0 lets the optimizer of
+ * RollingKmer and FastCover search for it. Returns the dictionary size, or 0 if training fails (e.g. too few samples).
+ */
+int trainDictionary(char* dictBuffer, int dictCapacity, const char* samples, const std::vector<size_t>& sampleSizes, const CompressionParameter& params, DictionaryAlgorithm dictAlgm, const TrainerParameter& trainer);
+
+// compresses a whole stripe as one frame of CodecT, as SBC and MBC do
+template<class CodecT>
+class CodecCompressor : public Compressor {
+protected:
+	typename CodecT::CCtx* _cctx;
+public:
+	CodecCompressor(CompressionParameter params);
+	virtual ~CodecCompressor();
+	virtual int compressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, DictionaryAlgorithm dictAlgm = RollingKmer);
+};
+
+template<class CodecT>
+class SBCCompressorT : public CodecCompressor<CodecT> {
 public:
-	SBCCompressor(CompressionParameter params);
-	virtual ~SBCCompressor();
+	SBCCompressorT(CompressionParameter params);
+	virtual ~SBCCompressorT();
 };
 
-class MBCCompressor : public Compressor {
+template<class CodecT>
+class MBCCompressorT : public CodecCompressor<CodecT> {
 public:
-	MBCCompressor(CompressionParameter params);
-	virtual ~MBCCompressor();
+	MBCCompressorT(CompressionParameter params);
+	virtual ~MBCCompressorT();
 };
 
-class RACCompressor : public Compressor {
+template<class CodecT>
+class RACCompressorT : public CodecCompressor<CodecT> {
 private:
 	char* _dict_buffer;
 	int _dict_buffer_size;
+	int _shared_id; // file-level dictionary of the stripes, -1 when every stripe trains its own
+	typename CodecT::CDict* _shared_cdict;
+	TrainerParameter _trainer;
+	double _drift;
+	int _kept_dict_size; // size of the dictionary in _dict_buffer that later stripes may reuse, -1 when there is none
+	typename CodecT::CDict* _kept_cdict;
+	double _kept_ratio; // probe ratio of the kept dictionary on the stripe it was trained on
+	char* _probe_buffer;
+	int _last_dict_size; // size of the dictionary in _dict_buffer the previous stripe was compressed with
+	std::vector<char> _samples; // the blocks handed to the trainer, back to back
+	std::vector<size_t> _sample_sizes;
+	int _stripe_idx; // index in the file of the stripe being compressed, as given to beginStripe
+	std::vector<char> _job_dict; // where a training under a time budget writes its dictionary
+	// the training under a time budget; it may still run after its stripe gave up on it, and then holds _samples
+	std::future<int> _training;
+	// gather nSamples blocks of the stripe into _samples and _sample_sizes, as _trainer.sampling selects them
+	void sampleBlocks(const char* stripeBuffer, int stripeSize, int nSamples);
+	// the dictionary size of a stripe that gave up on its training, whose dictionary is then left in _dict_buffer
+	int budgetFallback();
+	void forgetKeptDictionary();
+	// compression ratio of DICT_PROBE_BLOCKS blocks spread evenly over the stripe, against cdict
+	double probeRatio(const typename CodecT::CDict* cdict, const char* srcBuffer, int srcSize);
 public:
-	RACCompressor(CompressionParameter params);
-	virtual ~RACCompressor();
+	RACCompressorT(CompressionParameter params);
+	virtual ~RACCompressorT();
 	// return 0 when it is compressed and dstSize is the size of compressed data, return 1 when compressed data is larger than uncompressed data.
-	int compressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, std::string dictAlgm = "rolling-kmer");
+	int compressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, DictionaryAlgorithm dictAlgm = RollingKmer);
+	void useSharedDictionary(int id, const char* dict, int dictSize);
+	void setDictionaryDrift(double threshold);
+	void setTrainerParameter(TrainerParameter trainer);
+	void beginStripe(int stripeIdx, bool runStart);
 	// return dictionary size
-	int generateDict(const char* stripeBuffer, const int stripeSize, char* &dictBuffer, int dictCapacity, std::string dictAlgm);
+	int generateDict(const char* stripeBuffer, const int stripeSize, char* &dictBuffer, int dictCapacity, DictionaryAlgorithm dictAlgm);
 };
 
+typedef SBCCompressorT<LZ4CodecTraits> SBCCompressor;
+typedef MBCCompressorT<LZ4CodecTraits> MBCCompressor;
+typedef RACCompressorT<LZ4CodecTraits> RACCompressor;
+typedef SBCCompressorT<ZSTDCodecTraits> ZSTDSBCCompressor;
+typedef MBCCompressorT<ZSTDCodecTraits> ZSTDMBCCompressor;
+typedef RACCompressorT<ZSTDCodecTraits> ZSTDRACCompressor;
+typedef SBCCompressorT<LZ4HCCodecTraits> LZ4HCSBCCompressor;
+typedef MBCCompressorT<LZ4HCCodecTraits> LZ4HCMBCCompressor;
+typedef RACCompressorT<LZ4HCCodecTraits> LZ4HCRACCompressor;
+
+// stock COVER sorts its suffix array through a file-static context pointer, so concurrent trainings corrupt each
+// other; patches/zdict.patch keeps that pointer per thread, and zstd 1.5.7 sorts with qsort_r where it has one
+#if defined(ZDICT_COVER_THREAD_SAFE) || (ZSTD_VERSION_NUMBER >= 10507 && (defined(__linux__) || defined(__APPLE__) || defined(_MSC_VER)))
+#define MBC_COVER_CONCURRENT 1
+#else
+#define MBC_COVER_CONCURRENT 0
+#endif
+
+// serializes COVER trainings when they cannot run concurrently; every RACCompressor instantiation shares this lock
+inline std::mutex& coverLock() {
+	static std::mutex lock;
+	return lock;
+}
+
+template<class CodecT>
+inline Compressor* createCompressorFor(CompressionAlgorithm algorithm, CompressionParameter params) {
+	if(algorithm == SBC) {
+		return new SBCCompressorT<CodecT>(params);
+	} else if(algorithm == MBC) {
+		return new MBCCompressorT<CodecT>(params);
+	} else if(algorithm == RAC) {
+		return new RACCompressorT<CodecT>(params);
+	}
+	std::cout << "ERROR: Compressor::create, unknown compression algorithm" << std::endl;
+	return NULL;
+}
+
 Compressor::Compressor(CompressionParameter params) {
 	_params = params;
-	_stream = LZ4_createStream();
 }
 
 Compressor::~Compressor() {}
 
-int Compressor::compressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, std::string dictAlgm) {
-	if(dstCapacity < LZ4_compressBound(srcSize)) {
-		std::cout << "ERROR: Compressor::compressStripe, dstCapacity < LZ4_compressBound(srcSize), dstCapacity is " << dstCapacity << " , LZ4_compressBound(srcSize) is " << LZ4_compressBound(srcSize) << std::endl;
+void Compressor::useSharedDictionary(int id, const char* dict, int dictSize) {
+	if(id >= 0) {
+		std::cout << "WARNING: Compressor::useSharedDictionary, only RAC compresses with a dictionary" << std::endl;
 	}
-//	int dstSize = LZ4_compress_fast_continue(_stream, srcBuffer, dstBuffer, srcSize, dstCapacity, 1);
-	std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-	int dstSize = LZ4_compress_fast(srcBuffer, dstBuffer, srcSize, dstCapacity, 1); // We should use this function instead of the above LZ4's API because SBC/MBC should not be dependent with previous block/multiple-block
-	std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-	gStats.compression_timer += t_end - t_start;
+}
+
+void Compressor::setDictionaryDrift(double threshold) {}
+
+void Compressor::setTrainerParameter(TrainerParameter trainer) {}
+
+void Compressor::beginStripe(int stripeIdx, bool runStart) {}
+
+Compressor* Compressor::create(CompressionAlgorithm algorithm, CompressionParameter params) {
+	if(params.codec == LZ4Codec) {
+		return createCompressorFor<LZ4CodecTraits>(algorithm, params);
+	} else if(params.codec == ZSTDCodec) {
+		return createCompressorFor<ZSTDCodecTraits>(algorithm, params);
+	} else if(params.codec == LZ4HCCodec) {
+		return createCompressorFor<LZ4HCCodecTraits>(algorithm, params);
+	}
+	std::cout << "ERROR: Compressor::create, unknown codec" << std::endl;
+	return NULL;
+}
+
+int Compressor::compressBound(CompressionParameter params, int srcSize) {
+	if(params.codec == ZSTDCodec) {
+		return ZSTDCodecTraits::bound(srcSize);
+	}
+	return LZ4CodecTraits::bound(srcSize);
+}
+
+template<class CodecT>
+CodecCompressor<CodecT>::CodecCompressor(CompressionParameter params) : Compressor(params) {
+	if(_params.codec != CodecT::codec) {
+		std::cout << "WARNING: CodecCompressor, params.codec does not match the codec of the compressor" << std::endl;
+		_params.codec = CodecT::codec;
+	}
+	_cctx = CodecT::createCCtx();
+}
+
+template<class CodecT>
+CodecCompressor<CodecT>::~CodecCompressor() {
+	if(_cctx) {
+		CodecT::freeCCtx(_cctx);
+		_cctx = NULL;
+	}
+}
+
+template<class CodecT>
+int CodecCompressor<CodecT>::compressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, DictionaryAlgorithm dictAlgm) {
+	if(dstCapacity < CodecT::bound(srcSize)) {
+		std::cout << "ERROR: Compressor::compressStripe, dstCapacity < compressBound(srcSize), dstCapacity is " << dstCapacity << " , compressBound(srcSize) is " << CodecT::bound(srcSize) << std::endl;
+	}
+	STATS_NOW(t_start);
+	// SBC/MBC stripes must not depend on a previous stripe, so every stripe is compressed as a frame of its own
+	int dstSize = CodecT::compress(_cctx, srcBuffer, srcSize, dstBuffer, dstCapacity, _params);
+	if(dstSize <= 0) {
+		std::cout << "ERROR: Compressor::compressStripe, compression failed" << std::endl;
+	}
+	STATS_NOW(t_end);
+	STATS_ADD_TIME(compression_timer, t_start, t_end);
+	STATS_RECORD_LATENCY(compress_stripe_histogram, t_start, t_end);
 	return dstSize;
 }
 
-SBCCompressor::SBCCompressor(CompressionParameter params) : Compressor(params) {
-	_mbc_enable = false;
-	_rac_enable = false;
-	_algorithm = SBC;
+template<class CodecT>
+SBCCompressorT<CodecT>::SBCCompressorT(CompressionParameter params) : CodecCompressor<CodecT>(params) {
+	this->_mbc_enable = false;
+	this->_rac_enable = false;
+	this->_algorithm = SBC;
 	
-	if(_params.number_of_blocks != 1) {
+	if(this->_params.number_of_blocks != 1) {
 		std::cout << "ERROR: SBCCompressor but number of blocks is not 1" << std::endl;
 	}
-	_params.max_dict = 0;
-	_params.k = 0;
-	_params.d = 0;
+	this->_params.max_dict = 0;
+	this->_params.k = 0;
+	this->_params.d = 0;
 }
 
-SBCCompressor::~SBCCompressor() {}
+template<class CodecT>
+SBCCompressorT<CodecT>::~SBCCompressorT() {}
 
-MBCCompressor::MBCCompressor(CompressionParameter params) : Compressor(params) {
-	_mbc_enable = true;
-	_rac_enable = false;
-	_algorithm = MBC;
+template<class CodecT>
+MBCCompressorT<CodecT>::MBCCompressorT(CompressionParameter params) : CodecCompressor<CodecT>(params) {
+	this->_mbc_enable = true;
+	this->_rac_enable = false;
+	this->_algorithm = MBC;
 
-	if(_params.number_of_blocks <= 1) {
+	if(this->_params.number_of_blocks <= 1) {
 		std::cout << "ERROR: MBCCompressor but number of blocks is less or equal to 1" << std::endl;
 	}
-	_params.max_dict = 0;
-	_params.k = 0;
-	_params.d = 0;
+	this->_params.max_dict = 0;
+	this->_params.k = 0;
+	this->_params.d = 0;
 }
 
-MBCCompressor::~MBCCompressor() {}
+template<class CodecT>
+MBCCompressorT<CodecT>::~MBCCompressorT() {}
 
-RACCompressor::RACCompressor(CompressionParameter params) : Compressor(params) {
-	_mbc_enable = false;
-	_rac_enable = true;
-	_algorithm = RAC;
+template<class CodecT>
+RACCompressorT<CodecT>::RACCompressorT(CompressionParameter params) : CodecCompressor<CodecT>(params) {
+	this->_mbc_enable = false;
+	this->_rac_enable = true;
+	this->_algorithm = RAC;
 
-	if(_params.number_of_blocks <= 1 || _params.max_dict <= 0 || _params.k <= 0 || _params.d <= 0) {
+	if(this->_params.number_of_blocks <= 1 || this->_params.max_dict <= 0 || this->_params.k < 0 || this->_params.d < 0) {
 		std::cout << "ERROR: RACCompressor but parameters are invalid" << std::endl;
 	}
-	_dict_buffer = new char[_params.max_dict];
-	_dict_buffer_size = _params.max_dict;
+	_dict_buffer = new char[this->_params.max_dict];
+	_dict_buffer_size = this->_params.max_dict;
+	_shared_id = -1;
+	_shared_cdict = NULL;
+	_trainer = defaultTrainerParameter();
+	_drift = DICT_DRIFT;
+	_kept_dict_size = -1;
+	_kept_cdict = NULL;
+	_kept_ratio = 0;
+	_probe_buffer = new char[CodecT::bound(this->_params.block_size)];
+	_last_dict_size = 0;
+	_stripe_idx = 0;
+}
+
+template<class CodecT>
+RACCompressorT<CodecT>::~RACCompressorT() {
+	if(_training.valid()) {
+		_training.wait();
+	}
+	if(_dict_buffer) {
+		delete [] _dict_buffer;
+		_dict_buffer = NULL;
+	}
+	if(_shared_cdict) {
+		CodecT::freeCDict(_shared_cdict);
+		_shared_cdict = NULL;
+	}
+	forgetKeptDictionary();
+	if(_probe_buffer) {
+		delete [] _probe_buffer;
+		_probe_buffer = NULL;
+	}
+}
+
+template<class CodecT>
+void RACCompressorT<CodecT>::setDictionaryDrift(double threshold) {
+	_drift = threshold > 0 ? threshold : 0;
+	forgetKeptDictionary();
 }
 
-RACCompressor::~RACCompressor() {}
+template<class CodecT>
+void RACCompressorT<CodecT>::setTrainerParameter(TrainerParameter trainer) {
+	/* a training given up on reads _samples until it finishes */
+	if(_training.valid()) {
+		_training.get();
+	}
+	_trainer = trainer;
+}
+
+template<class CodecT>
+void RACCompressorT<CodecT>::beginStripe(int stripeIdx, bool runStart) {
+	_stripe_idx = stripeIdx;
+	if(runStart) {
+		forgetKeptDictionary();
+	}
+}
 
-int RACCompressor::compressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, std::string dictAlgm) {
+template<class CodecT>
+void RACCompressorT<CodecT>::forgetKeptDictionary() {
+	if(_kept_cdict) {
+		CodecT::freeCDict(_kept_cdict);
+		_kept_cdict = NULL;
+	}
+	_kept_dict_size = -1;
+}
+
+template<class CodecT>
+double RACCompressorT<CodecT>::probeRatio(const typename CodecT::CDict* cdict, const char* srcBuffer, int srcSize) {
+	int blockSize = this->_params.block_size;
+	int nBlocks = (srcSize-1)/blockSize+1;
+	int nProbes = nBlocks < DICT_PROBE_BLOCKS ? nBlocks : DICT_PROBE_BLOCKS;
+	long long int rawBytes = 0;
+	long long int cmpBytes = 0;
+	for(int i = 0; i < nProbes; ++i) {
+		int blockIdx = (long long int) nBlocks * i / nProbes;
+		const char* block = srcBuffer + (long long int) blockIdx * blockSize;
+		int len = srcSize - blockIdx * blockSize < blockSize ? srcSize - blockIdx * blockSize : blockSize;
+		int cmpSize = CodecT::compressUsingCDict(this->_cctx, cdict, block, len, _probe_buffer, CodecT::bound(blockSize), this->_params);
+		rawBytes += len;
+		cmpBytes += cmpSize <= 0 || cmpSize > len ? len : cmpSize;
+	}
+	return (double) rawBytes / cmpBytes;
+}
+
+template<class CodecT>
+void RACCompressorT<CodecT>::useSharedDictionary(int id, const char* dict, int dictSize) {
+	if(id == _shared_id) {
+		return;
+	}
+	if(_shared_cdict) {
+		CodecT::freeCDict(_shared_cdict);
+		_shared_cdict = NULL;
+	}
+	_shared_id = id < 0 ? -1 : id;
+	if(_shared_id >= 0) {
+		/* consecutive stripes of a shard share the prepared dictionary */
+		_shared_cdict = CodecT::createCDict(dict, dictSize, this->_params);
+	}
+}
+
+template<class CodecT>
+int RACCompressorT<CodecT>::compressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, DictionaryAlgorithm dictAlgm) {
+	STATS_NOW(t_stripe_start);
+	const CompressionParameter& params = this->_params;
 	int dstSize = 0;
-	int blockSize = _params.block_size;
-	int blockCapacity = LZ4_compressBound(blockSize);
-	int dictCapacity = _params.max_dict;
-	if(!_dict_buffer || _dict_buffer_size < _params.max_dict) {
+	int blockSize = params.block_size;
+	int blockCapacity = CodecT::bound(blockSize);
+	int dictCapacity = params.max_dict;
+	if(!_dict_buffer || _dict_buffer_size < params.max_dict) {
 		std::cout << "WARNING: RACCompressor::compressStripe, recreating dictionary buffer" << std::endl;
 		if(_dict_buffer) {
 			delete [] _dict_buffer;
 		}
-		_dict_buffer = new char[_params.max_dict*2];
-		_dict_buffer_size = _params.max_dict;
+		_dict_buffer = new char[params.max_dict*2];
+		_dict_buffer_size = params.max_dict;
 	}
-	int dictSize = generateDict(srcBuffer, srcSize, _dict_buffer, dictCapacity, dictAlgm);
+	/* the dictionary is prepared once per stripe and reused for every block */
+	int dictSize = 0;
+	typename CodecT::CDict* cdict = NULL;
+	bool reuse = false;
+	if(_shared_id < 0 && _drift > 0 && _kept_dict_size >= 0) {
+		/* a few blocks tell whether the data has drifted away from the previous stripe's dictionary */
+		STATS_NOW(t_start);
+		reuse = probeRatio(_kept_cdict, srcBuffer, srcSize) >= _kept_ratio * (1 - _drift);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(dictionary_timer, t_start, t_end);
+	}
+	if(_shared_id >= 0) {
+		cdict = _shared_cdict;
+	} else if(reuse) {
+		dictSize = _kept_dict_size;
+		cdict = _kept_cdict;
+		gStats.local().dict_reused_stripes++;
+	} else {
+		forgetKeptDictionary();
+		dictSize = generateDict(srcBuffer, srcSize, _dict_buffer, dictCapacity, dictAlgm);
+		cdict = CodecT::createCDict(_dict_buffer, dictSize, params);
+		gStats.local().dict_retrained_stripes++;
+		if(_drift > 0) {
+			STATS_NOW(t_start);
+			_kept_dict_size = dictSize;
+			_kept_cdict = cdict;
+			_kept_ratio = probeRatio(cdict, srcBuffer, srcSize);
+			STATS_NOW(t_end);
+			STATS_ADD_TIME(dictionary_timer, t_start, t_end);
+		}
+	}
+	if(_shared_id < 0) {
+		_last_dict_size = dictSize;
+		/* counted here rather than in trainDictionary, so a dictionary that came too late for its stripe is not,
+		 * and a reused one is, as the stripe stores it again
+		 */
+		gStats.local().total_dictionary_size += dictSize;
+	}
+	/* a stripe on a file-level dictionary stores -(id+1) in place of the dictionary size and no dictionary */
+	int dictField = _shared_id >= 0 ? -(_shared_id+1) : dictSize;
 	char* p = dstBuffer;
-	memcpy(p, &dictSize, sizeof(int));
+	memcpy(p, &dictField, sizeof(int));
 	p += sizeof(int);
 	dstSize += sizeof(int);
 	memcpy(p, _dict_buffer, dictSize);
@@ -146,14 +451,14 @@ int RACCompressor::compressStripe(const char* srcBuffer, const int srcSize, char
 	while(cur < end) {
 		int distToEnd = end - cur;
 		int len = distToEnd < blockSize ? distToEnd : blockSize;
-		std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-		LZ4_loadDict(_stream, (const char*) _dict_buffer, dictSize);
-		int cmpSize = LZ4_compress_fast_continue(_stream, cur, p2, len, blockCapacity, 1);
-		std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-		gStats.compression_timer += t_end - t_start;
-		if(cmpSize >= blockSize) {
-			memcpy(p2, cur, blockSize);
-			cmpSize = blockSize;
+		STATS_NOW(t_start);
+		int cmpSize = CodecT::compressUsingCDict(this->_cctx, cdict, cur, len, p2, blockCapacity, params);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(compression_timer, t_start, t_end);
+		if(cmpSize <= 0 || cmpSize >= len) {
+			/* store the block raw; decoders recognize it by compressedBlockSize == rawBlockSize */
+			memcpy(p2, cur, len);
+			cmpSize = len;
 		}
 		dstSize += cmpSize;
 		StripeEntry e = {offset, len, cmpSize};
@@ -163,50 +468,182 @@ int RACCompressor::compressStripe(const char* srcBuffer, const int srcSize, char
 		p2 += cmpSize;
 		cur += len;
 	}
+	if(cdict && cdict != _shared_cdict && cdict != _kept_cdict) {
+		CodecT::freeCDict(cdict);
+	}
+	STATS_NOW(t_stripe_end);
+	STATS_RECORD_LATENCY(compress_stripe_histogram, t_stripe_start, t_stripe_end);
+	return dstSize;
+}
+
+template<class CodecT>
+int RACCompressorT<CodecT>::generateDict(const char* stripeBuffer, const int stripeSize, char* &dictBuffer, int dictCapacity, DictionaryAlgorithm dictAlgm) {
+	int blockSize = this->_params.block_size;
+	int nBlocks = (stripeSize-1)/blockSize+1;
+	int nSamples = _trainer.sample_blocks > 0 ? _trainer.sample_blocks : (int) (_trainer.sample_fraction * nBlocks + 0.5);
+	nSamples = nSamples < 1 ? 1 : nSamples > nBlocks ? nBlocks : nSamples;
+	if(_trainer.budget_ms <= 0) {
+		if(nSamples < nBlocks) {
+			sampleBlocks(stripeBuffer, stripeSize, nSamples);
+			return trainDictionary(dictBuffer, dictCapacity, _samples.data(), _sample_sizes, this->_params, dictAlgm, _trainer);
+		}
+		/* every block of the stripe is a sample */
+		const char* cur = stripeBuffer;
+		const char* end = cur + stripeSize;
+		std::vector<size_t> sizeVector;
+		while(cur < end) {
+			size_t distToEnd = end - cur;
+			size_t len = distToEnd < blockSize ? distToEnd : blockSize;
+			sizeVector.push_back(len);
+			cur += len;
+		}
+		return trainDictionary(dictBuffer, dictCapacity, stripeBuffer, sizeVector, this->_params, dictAlgm, _trainer);
+	}
+	/* ZDICT cannot be interrupted, so under a time budget it trains on a thread of its own and the stripe stops
+	 * waiting when the budget runs out; a training given up on must finish before the next one starts
+	 */
+	if(_training.valid()) {
+		if(_training.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return budgetFallback();
+		}
+		int lateDictSize = _training.get();
+		if(_trainer.fallback == PreviousDictionary) {
+			/* the dictionary that came too late for its own stripe is the freshest one to fall back on */
+			memcpy(dictBuffer, _job_dict.data(), lateDictSize);
+			_last_dict_size = lateDictSize;
+		}
+	}
+#if !MBC_COVER_CONCURRENT
+	/* a training another stripe gave up on may still hold coverLock(); queueing behind it would only spend this
+	 * stripe's budget, so such a stripe falls back at once and no more COVER jobs pile up
+	 */
+	if(dictAlgm == RollingKmer) {
+		if(!coverLock().try_lock()) {
+			return budgetFallback();
+		}
+		coverLock().unlock();
+	}
+#endif
+	sampleBlocks(stripeBuffer, stripeSize, nSamples);
+	_job_dict.resize(dictCapacity);
+	_training = std::async(std::launch::async, trainDictionary, _job_dict.data(), dictCapacity, (const char*) _samples.data(), _sample_sizes, this->_params, dictAlgm, _trainer);
+	if(_training.wait_for(std::chrono::duration<double, std::milli>(_trainer.budget_ms)) != std::future_status::ready) {
+		return budgetFallback();
+	}
+	int dictSize = _training.get();
+	memcpy(dictBuffer, _job_dict.data(), dictSize);
+	return dictSize;
+}
+
+template<class CodecT>
+void RACCompressorT<CodecT>::sampleBlocks(const char* stripeBuffer, int stripeSize, int nSamples) {
+	int blockSize = this->_params.block_size;
+	int nBlocks = (stripeSize-1)/blockSize+1;
+	std::vector<int> blockIdxs;
+	if(_trainer.sampling == RandomSampling && nSamples < nBlocks) {
+		/* a partial Fisher-Yates shuffle draws distinct blocks, which are then sampled in stripe order; seeded per
+		 * stripe, so a stripe gets the same blocks whichever thread compresses it
+		 */
+		std::seed_seq seed{(unsigned) RANDOM_SEED, (unsigned) _stripe_idx};
+		std::mt19937 rng(seed);
+		std::vector<int> order(nBlocks);
+		for(int i = 0; i < nBlocks; ++i) {
+			order[i] = i;
+		}
+		for(int i = 0; i < nSamples; ++i) {
+			std::uniform_int_distribution<int> dist(i, nBlocks-1);
+			std::swap(order[i], order[dist(rng)]);
+		}
+		blockIdxs.assign(order.begin(), order.begin() + nSamples);
+		std::sort(blockIdxs.begin(), blockIdxs.end());
+	} else {
+		for(int i = 0; i < nSamples; ++i) {
+			blockIdxs.push_back((long long int) nBlocks * i / nSamples);
+		}
+	}
+	_samples.clear();
+	_sample_sizes.clear();
+	for(int i = 0; i < blockIdxs.size(); ++i) {
+		const char* block = stripeBuffer + (long long int) blockIdxs[i] * blockSize;
+		int len = stripeSize - blockIdxs[i] * blockSize < blockSize ? stripeSize - blockIdxs[i] * blockSize : blockSize;
+		_samples.insert(_samples.end(), block, block + len);
+		_sample_sizes.push_back(len);
+	}
+}
 
-	return dstSize + sizeof(int);
+template<class CodecT>
+int RACCompressorT<CodecT>::budgetFallback() {
+	gStats.local().dict_budget_overruns++;
+	return _trainer.fallback == PreviousDictionary ? _last_dict_size : 0;
 }
 
-int RACCompressor::generateDict(const char* stripeBuffer, const int stripeSize, char* &dictBuffer, int dictCapacity, std::string dictAlgm) {
+int trainDictionary(char* dictBuffer, int dictCapacity, const char* samples, const std::vector<size_t>& sampleSizes, const CompressionParameter& params, DictionaryAlgorithm dictAlgm, const TrainerParameter& trainer) {
 	/* generate dictionary */
 	ZDICT_params_t zParams;
-	zParams.compressionLevel = 1;
+	memset(&zParams, 0, sizeof(ZDICT_params_t));
+	zParams.compressionLevel = params.codec == ZSTDCodec ? params.level : 1;
 	zParams.notificationLevel = 1;
 	zParams.dictID = 0;
 
-	ZDICT_cover_params_t* coverParams = new ZDICT_cover_params_t;
-	ZDICT_legacy_params_t* legacyParams = new ZDICT_legacy_params_t;
-	if(dictAlgm == "rolling-kmer") {
-		coverParams->k = _params.k;
-		coverParams->d = _params.d;
-		coverParams->steps = 1000; // should not matter
-		coverParams->nbThreads = 1;
-		coverParams->zParams = zParams;
-	} else if(dictAlgm == "suffix-array") {
-		legacyParams->zParams = zParams;
-	}
-	int blockSize = _params.block_size;
-
-	const char* cur = stripeBuffer;
-	const char* end = cur + stripeSize;
-	unsigned nbSamples = (stripeSize % _params.block_size == 0) ? stripeSize / _params.block_size : stripeSize / _params.block_size + 1;
-	std::vector<size_t> sizeVector;
-	while(cur < end) {
-		size_t distToEnd = end - cur;
-		size_t len = distToEnd < blockSize ? distToEnd : blockSize;
-		sizeVector.push_back(len);
-		cur += len;
+#if ZSTD_VERSION_NUMBER < 10306
+	/* only a caller built against an older zstd than do_cmake.sh pins gets here; tell it once, not per stripe */
+	if(dictAlgm == FastCover) {
+		static std::once_flag warned;
+		std::call_once(warned, []() {
+			std::cout << "WARNING: trainDictionary, FastCover needs zstd 1.3.6 or later, use RollingKmer instead" << std::endl;
+		});
+		dictAlgm = RollingKmer;
 	}
-	std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-	int dictSize = -1;
-	if(dictAlgm == "rolling-kmer") {
-		dictSize = ZDICT_optimizeTrainFromBuffer_cover(dictBuffer, dictCapacity, (const void*) stripeBuffer, sizeVector.data(), nbSamples, coverParams);
-	} else if(dictAlgm == "suffix-array") {
-		dictSize = ZDICT_trainFromBuffer_legacy(dictBuffer, dictCapacity, (const void*) stripeBuffer, sizeVector.data(), nbSamples, *legacyParams);
+#endif
+	unsigned nbSamples = sampleSizes.size();
+	STATS_NOW(t_start);
+	size_t ret = 0;
+	if(dictAlgm == RollingKmer) {
+		ZDICT_cover_params_t coverParams;
+		memset(&coverParams, 0, sizeof(ZDICT_cover_params_t));
+		coverParams.k = params.k;
+		coverParams.d = params.d;
+		coverParams.steps = 0; // k values the optimizer tries when it searches k; 0 uses zstd's default
+		coverParams.nbThreads = trainer.threads;
+		coverParams.zParams = zParams;
+#if !MBC_COVER_CONCURRENT
+		std::lock_guard<std::mutex> guard(coverLock());
+#endif
+		ret = ZDICT_optimizeTrainFromBuffer_cover(dictBuffer, dictCapacity, (const void*) samples, sampleSizes.data(), nbSamples, &coverParams);
+#if ZSTD_VERSION_NUMBER >= 10306
+	} else if(dictAlgm == FastCover) {
+		/* FastCover counts k-mers in a hashed frequency table instead of sorting suffixes, so it needs no lock */
+		ZDICT_fastCover_params_t fastCoverParams;
+		memset(&fastCoverParams, 0, sizeof(ZDICT_fastCover_params_t));
+		fastCoverParams.k = params.k;
+		fastCoverParams.d = params.d;
+		fastCoverParams.f = trainer.f;
+		fastCoverParams.accel = trainer.accel;
+		fastCoverParams.nbThreads = trainer.threads;
+		fastCoverParams.zParams = zParams;
+		ret = ZDICT_optimizeTrainFromBuffer_fastCover(dictBuffer, dictCapacity, (const void*) samples, sampleSizes.data(), nbSamples, &fastCoverParams);
+#endif
+	} else if(dictAlgm == SuffixArray) {
+		ZDICT_legacy_params_t legacyParams;
+		memset(&legacyParams, 0, sizeof(ZDICT_legacy_params_t));
+		legacyParams.zParams = zParams;
+		ret = ZDICT_trainFromBuffer_legacy(dictBuffer, dictCapacity, (const void*) samples, sampleSizes.data(), nbSamples, legacyParams);
+	} else if(dictAlgm == NativeKmer) {
+		KmerDictionaryBuilder builder(params.k, params.d);
+		if(params.codec == ZSTDCodec) {
+			/* the builder only picks the content; a zstd dictionary also carries entropy tables fitted to the samples */
+			std::vector<char> content(dictCapacity);
+			int contentSize = builder.build(content.data(), dictCapacity, samples, sampleSizes);
+			ret = contentSize > 0 ? ZDICT_finalizeDictionary(dictBuffer, dictCapacity, content.data(), contentSize, (const void*) samples, sampleSizes.data(), nbSamples, zParams) : 0;
+		} else {
+			ret = builder.build(dictBuffer, dictCapacity, samples, sampleSizes);
+		}
 	}
-	std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-	gStats.dictionary_timer += t_end - t_start;
-	gStats.total_dictionary_size += dictSize;
+	// training fails on tiny inputs (e.g. the tail of a file); compress those blocks without a dictionary
+	int dictSize = ZDICT_isError(ret) ? 0 : (int) ret;
+	STATS_NOW(t_end);
+	STATS_ADD_TIME(dictionary_timer, t_start, t_end);
+	STATS_RECORD_LATENCY(generate_dict_histogram, t_start, t_end);
 	return dictSize;
 }
 
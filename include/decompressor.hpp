@@ -1,167 +1,293 @@
 #ifndef DECOMPRESSOR_H
 #define DECOMPRESSOR_H
 
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "common.h"
-#include "lz4.h"
-#include "zdict.h"
-#include "zstd.h"
+#include "codec.hpp"
 
+/* Decompressor is the interface Filer and CompressedFileReader see. As with Compressor, the SBC/MBC/RAC
+ * decompressors are templates on a codec traits class (see codec.hpp) and Decompressor::create picks the
+ * instantiation from the algorithm and params.codec.
+ */
 class Decompressor {
 protected:
 	bool _mbc_enable;
 	bool _rac_enable;
 	CompressionAlgorithm _algorithm;
 	CompressionParameter _params;
-	LZ4_streamDecode_t* _stream;
 public:
 	Decompressor(CompressionParameter params);
-	void resetStream();
 	virtual ~Decompressor();
+	// a decompressor for algorithm with the codec of params, NULL if either is unknown
+	static Decompressor* create(CompressionAlgorithm algorithm, CompressionParameter params);
 	virtual char* getDictBuffer();
 	virtual int getDictBufferSize();
-	// return decompressed size; we use LZ4_decompress_safe_continue in this function but we know dstCapacity is the same as return value;
+	// return decompressed size
+	virtual int decompressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity) = 0;
+	/* Return the size of block blockIdx, negative on error. decodedSize, if not NULL, gets the number of bytes the
+	 * codec decoded to produce it, which for MBC can be the whole stripe.
+	 */
+	virtual int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize = NULL) = 0;
+};
+
+// decodes a stripe that was compressed as one frame of CodecT, as SBC and MBC do
+template<class CodecT>
+class CodecDecompressor : public Decompressor {
+public:
+	CodecDecompressor(CompressionParameter params);
+	virtual ~CodecDecompressor();
 	virtual int decompressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity);
-	virtual int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx);
 };
 
-class SBCDecompressor : public Decompressor {
+template<class CodecT>
+class SBCDecompressorT : public CodecDecompressor<CodecT> {
 public:
-	SBCDecompressor(CompressionParameter params);
-	virtual ~SBCDecompressor();
-	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx);
+	SBCDecompressorT(CompressionParameter params);
+	virtual ~SBCDecompressorT();
+	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize = NULL);
 };
 
-class MBCDecompressor : public Decompressor {
+template<class CodecT>
+class MBCDecompressorT : public CodecDecompressor<CodecT> {
 public:
-	MBCDecompressor(CompressionParameter params);
-	virtual ~MBCDecompressor();
-	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx);
+	MBCDecompressorT(CompressionParameter params);
+	virtual ~MBCDecompressorT();
+	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize = NULL);
 };
 
-class RACDecompressor : public Decompressor {
-private:
+// the codec-independent part of RAC: the stripe header layout and the per-block entry points readers call
+class RACDecompressorBase : public Decompressor {
+protected:
 	char* _dict_buffer;
 	int _dict_buffer_size;
+	std::vector<std::string> _shared_dicts;
+	/* The dictionaries registered by addLazyDictionaries take ids from _lazy_first on. _lazy_pos holds the file
+	 * offset of each, and _lazy_ready turns true once its bytes are in _shared_dicts.
+	 */
+	int _lazy_first;
+	std::vector<long long int> _lazy_pos;
+	std::atomic<bool>* _lazy_ready;
+	std::function<bool(char*, int, long long int)> _lazy_read;
+	std::mutex _lazy_lock;
+	// bytes of dictionary stored in a stripe header; a stripe on a shared dictionary stores none
+	static int inlineDictSize(const char* stripeHeader);
+	// the dictionary of a stripe: in its header (sharedId is -1), or shared dictionary sharedId of the file; false if that one is not loaded
+	bool stripeDictionary(const char* stripeHeader, const char* &dict, int &dictSize, int &sharedId);
+	// read lazy dictionary sharedId into _shared_dicts unless another thread did; false if it cannot be read
+	bool loadLazyDictionary(int sharedId);
+	// called once the bytes of shared dictionary sharedId are loaded, so a codec can prepare it
+	virtual void prepareSharedDictionary(int sharedId);
 public:
-	RACDecompressor(CompressionParameter params);
-	virtual ~RACDecompressor();
+	RACDecompressorBase(CompressionParameter params);
+	virtual ~RACDecompressorBase();
 	char* getDictBuffer();
 	int getDictBufferSize();
-	// return decompressed size; we use LZ4_decompress_safe_continue in this function but we know dstCapacity is the same as return value;
+	// parse the dictionary and entries once, then decode block blockIdxs[i] into dstBuffers[i] (block_size bytes) and its size into dstSizes[i]; return the number of blocks decoded
+	virtual int decompressBlocks(const char* stripeBuffer, const int stripeSize, const std::vector<int>& blockIdxs, const std::vector<char*>& dstBuffers, std::vector<int>& dstSizes) = 0;
+	// length of the [dictSize][dict][nBlocks][entries] header that opens a compressed RAC stripe; the block data follows it
+	static int stripeHeaderSize(const char* stripeHeader);
+	// copy entry blockIdx out of a stripe header; false if blockIdx is not within range
+	static bool getEntry(const char* stripeHeader, int blockIdx, StripeEntry& entry);
+	// decode one block whose compressed bytes are at blockData against the dictionary held in stripeHeader
+	virtual int decompressEntry(const char* stripeHeader, const StripeEntry& entry, const char* blockData, char* dstBuffer, int dstCapacity) = 0;
+	/* Load the file-level dictionaries that stripes refer to by id from a dictionary section
+	 * [int nDicts]([int dictSize][dict] x nDicts): the one of the file header, then the one after the payload.
+	 * Each call appends, so ids continue across sections; false if the section is malformed.
+	 */
+	virtual bool loadSharedDictionaries(const char* section, int sectionSize);
+	/* Register the dictionaries of an index [int nDicts]([int dictSize] x nDicts) as the next file-level ids. Their
+	 * bytes lie back to back from file offset dictPos and are fetched through read(buffer, size, pos) the first
+	 * time a stripe refers to them, so opening a file costs only the index. Registered after every
+	 * loadSharedDictionaries call, at most once; false if the index is malformed.
+	 */
+	virtual bool addLazyDictionaries(const char* index, int indexSize, long long int dictPos, std::function<bool(char*, int, long long int)> read);
+	int getNumberOfSharedDictionaries();
+};
+
+template<class CodecT>
+class RACDecompressorT : public RACDecompressorBase {
+private:
+	// the shared dictionaries prepared once for the codec, NULL where it has no prepared form
+	std::vector<typename CodecT::DDict*> _shared_ddicts;
+	void freeSharedDDicts();
+	void prepareSharedDictionary(int sharedId);
+	// decode one block against dict, or against ddict when it is not NULL; negative on error
+	int decodeBlock(const char* src, int srcSize, char* dst, int dstCapacity, const char* dict, int dictSize, const typename CodecT::DDict* ddict);
+public:
+	RACDecompressorT(CompressionParameter params);
+	virtual ~RACDecompressorT();
 	int decompressStripe(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity);
-	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx);
+	int decompressBlock(const char* stripeBuffer, const int stripeSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize = NULL);
+	int decompressBlocks(const char* stripeBuffer, const int stripeSize, const std::vector<int>& blockIdxs, const std::vector<char*>& dstBuffers, std::vector<int>& dstSizes);
+	int decompressEntry(const char* stripeHeader, const StripeEntry& entry, const char* blockData, char* dstBuffer, int dstCapacity);
+	bool loadSharedDictionaries(const char* section, int sectionSize);
+	bool addLazyDictionaries(const char* index, int indexSize, long long int dictPos, std::function<bool(char*, int, long long int)> read);
 };
 
+typedef SBCDecompressorT<LZ4CodecTraits> SBCDecompressor;
+typedef MBCDecompressorT<LZ4CodecTraits> MBCDecompressor;
+typedef RACDecompressorT<LZ4CodecTraits> RACDecompressor;
+typedef SBCDecompressorT<ZSTDCodecTraits> ZSTDSBCDecompressor;
+typedef MBCDecompressorT<ZSTDCodecTraits> ZSTDMBCDecompressor;
+typedef RACDecompressorT<ZSTDCodecTraits> ZSTDRACDecompressor;
+typedef SBCDecompressorT<LZ4HCCodecTraits> LZ4HCSBCDecompressor;
+typedef MBCDecompressorT<LZ4HCCodecTraits> LZ4HCMBCDecompressor;
+typedef RACDecompressorT<LZ4HCCodecTraits> LZ4HCRACDecompressor;
+
+template<class CodecT>
+inline Decompressor* createDecompressorFor(CompressionAlgorithm algorithm, CompressionParameter params) {
+	if(algorithm == SBC) {
+		return new SBCDecompressorT<CodecT>(params);
+	} else if(algorithm == MBC) {
+		return new MBCDecompressorT<CodecT>(params);
+	} else if(algorithm == RAC) {
+		return new RACDecompressorT<CodecT>(params);
+	}
+	std::cout << "ERROR: Decompressor::create, unknown compression algorithm" << std::endl;
+	return NULL;
+}
+
 Decompressor::Decompressor(CompressionParameter params) {
 	_params = params;
-	_stream = LZ4_createStreamDecode();
 }
 
-void Decompressor::resetStream() {
-	if(_stream) {
-		delete _stream;
-		_stream = NULL;
+Decompressor::~Decompressor() {}
+
+Decompressor* Decompressor::create(CompressionAlgorithm algorithm, CompressionParameter params) {
+	if(params.codec == LZ4Codec) {
+		return createDecompressorFor<LZ4CodecTraits>(algorithm, params);
+	} else if(params.codec == ZSTDCodec) {
+		return createDecompressorFor<ZSTDCodecTraits>(algorithm, params);
+	} else if(params.codec == LZ4HCCodec) {
+		return createDecompressorFor<LZ4HCCodecTraits>(algorithm, params);
 	}
-	_stream = LZ4_createStreamDecode();
+	std::cout << "ERROR: Decompressor::create, unknown codec" << std::endl;
+	return NULL;
 }
 
-Decompressor::~Decompressor() {}
-
 char* Decompressor::getDictBuffer() { return NULL; }
 int Decompressor::getDictBufferSize() { return -1; }
 
-int Decompressor::decompressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity) {
-//	int decSize = LZ4_decompress_safe_continue (_stream, srcBuffer, dstBuffer, srcSize, dstCapacity);
-	std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-	int decSize = LZ4_decompress_safe (srcBuffer, dstBuffer, srcSize, dstCapacity); // We should use this LZ4's API instead of the above one because SBC/MBC should not be dependent with previous block/multiple-block
-	std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-	gStats.decompression_timer += t_end - t_start;
-	return decSize;
+template<class CodecT>
+CodecDecompressor<CodecT>::CodecDecompressor(CompressionParameter params) : Decompressor(params) {
+	if(_params.codec != CodecT::codec) {
+		std::cout << "WARNING: CodecDecompressor, params.codec does not match the codec of the decompressor" << std::endl;
+		_params.codec = CodecT::codec;
+	}
 }
 
-int Decompressor::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx) {
-	std::cout << "WARNING: Decompressor::decompressBlock should not be called" << std::endl;
-	int decSize = LZ4_decompress_safe_continue (_stream, srcBuffer, dstBuffer, srcSize, dstCapacity);
+template<class CodecT>
+CodecDecompressor<CodecT>::~CodecDecompressor() {}
+
+template<class CodecT>
+int CodecDecompressor<CodecT>::decompressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity) {
+	STATS_NOW(t_start);
+	// SBC/MBC stripes do not depend on a previous stripe, so every stripe is decoded on its own
+	int decSize = CodecT::decompress(srcBuffer, srcSize, dstBuffer, dstCapacity);
+	STATS_NOW(t_end);
+	STATS_ADD_TIME(decompression_timer, t_start, t_end);
+	STATS_RECORD_LATENCY(decompress_stripe_histogram, t_start, t_end);
 	return decSize;
 }
 
-SBCDecompressor::SBCDecompressor(CompressionParameter params) : Decompressor(params) {
-	_mbc_enable = false;
-	_rac_enable = false;
-	_algorithm = SBC;
-	if(_params.number_of_blocks != 1) {
+template<class CodecT>
+SBCDecompressorT<CodecT>::SBCDecompressorT(CompressionParameter params) : CodecDecompressor<CodecT>(params) {
+	this->_mbc_enable = false;
+	this->_rac_enable = false;
+	this->_algorithm = SBC;
+	if(this->_params.number_of_blocks != 1) {
 		std::cout << "ERROR: SBCDecompressor number of block is not 1" << std::endl;
 	}
 }
 
-SBCDecompressor::~SBCDecompressor() {}
+template<class CodecT>
+SBCDecompressorT<CodecT>::~SBCDecompressorT() {}
 
-int SBCDecompressor::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx) {
+template<class CodecT>
+int SBCDecompressorT<CodecT>::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize) {
 	if(blockIdx != 0) {
 		std::cout << "ERROR: SBCDecompressor::decompressBlock, blockIdx != 0" << std::endl;
 	}
-//	int decSize = LZ4_decompress_safe_continue (_stream, srcBuffer, dstBuffer, srcSize, dstCapacity);
-	std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-	int decSize = LZ4_decompress_safe (srcBuffer, dstBuffer, srcSize, dstCapacity);
-	std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-	gStats.decompression_timer += t_end - t_start;
+	STATS_NOW(t_start);
+	int decSize = CodecT::decompress(srcBuffer, srcSize, dstBuffer, dstCapacity);
+	STATS_NOW(t_end);
+	STATS_ADD_TIME(decompression_timer, t_start, t_end);
+	STATS_RECORD_LATENCY(decompress_block_histogram, t_start, t_end);
+	if(decodedSize) {
+		*decodedSize = decSize > 0 ? decSize : 0;
+	}
 	return decSize;
 }
 
-MBCDecompressor::MBCDecompressor(CompressionParameter params) : Decompressor(params) {
-	_mbc_enable = true;
-	_rac_enable = false;
-	_algorithm = MBC;
-	if(_params.number_of_blocks <= 1) {
+template<class CodecT>
+MBCDecompressorT<CodecT>::MBCDecompressorT(CompressionParameter params) : CodecDecompressor<CodecT>(params) {
+	this->_mbc_enable = true;
+	this->_rac_enable = false;
+	this->_algorithm = MBC;
+	if(this->_params.number_of_blocks <= 1) {
 		std::cout << "ERROR: MBCDecompressor number of block is less or equal to 1" << std::endl;
 	}
 }
 
-MBCDecompressor::~MBCDecompressor() {}
+template<class CodecT>
+MBCDecompressorT<CodecT>::~MBCDecompressorT() {}
 
-int MBCDecompressor::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx) {
-	if(blockIdx < 0 || blockIdx > _params.number_of_blocks-1) {
+template<class CodecT>
+int MBCDecompressorT<CodecT>::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize) {
+	STATS_NOW(t_block_start);
+	const CompressionParameter& params = this->_params;
+	if(blockIdx < 0 || blockIdx > params.number_of_blocks-1) {
 		std::cout << "ERROR: MBCDecompressor::decompressBlock, blockIdx is not within range" << std::endl;
 	}
-	int stripeSize = _params.block_size * _params.number_of_blocks;
+	int stripeSize = params.block_size * params.number_of_blocks;
 	int decSize = -1;
+	/* decoding stops once the requested block has been produced, if the codec can stop early */
+	int targetSize = (blockIdx + 1) * params.block_size;
 	if(dstCapacity < stripeSize) {
-		std::cout << "WARNING: MBCDecompressor::decompressBlock, dstCapacity < stripeSize" << std::endl;
-		char* buffer = NULL;
-		buffer = new char[stripeSize];
-//		decSize = LZ4_decompress_safe_continue (_stream, srcBuffer, buffer, srcSize, stripeSize);
-		std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-		decSize = LZ4_decompress_safe (srcBuffer, buffer, srcSize, stripeSize);
-		std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-		gStats.decompression_timer += t_end - t_start;
-		/* last stripe does not satisfy this condition
-		if(decSize != stripeSize) {
-			std::cout << "WARNING: MBCDecompressor::decompressBlock, decSize != stripeSize" << std::endl;
+		/* the stripe is decoded into a per-thread scratch buffer that is reused across calls */
+		static thread_local std::vector<char> buffer;
+		if(buffer.size() < stripeSize) {
+			buffer.resize(stripeSize);
 		}
-		*/
-		int offset = blockIdx * _params.block_size;
-		memcpy(dstBuffer, buffer+offset, _params.block_size);
-		delete [] buffer;
+		STATS_NOW(t_start);
+		decSize = CodecT::decompressPrefix(srcBuffer, srcSize, buffer.data(), targetSize, stripeSize);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(decompression_timer, t_start, t_end);
+		int offset = blockIdx * params.block_size;
+		memcpy(dstBuffer, buffer.data()+offset, params.block_size);
 	} else {
-//		decSize = LZ4_decompress_safe_continue (_stream, srcBuffer, dstBuffer, srcSize, dstCapacity);
-		std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-		decSize = LZ4_decompress_safe (srcBuffer, dstBuffer, srcSize, dstCapacity);
-		std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-		gStats.decompression_timer += t_end - t_start;
-		/*
-		if(decSize != stripeSize) {
-			std::cout << "WARNING: MBCDecompressor::decompressBlock, decSize != stripeSize" << std::endl;
-		}
-		*/
-		int offset = blockIdx * _params.block_size;
+		STATS_NOW(t_start);
+		decSize = CodecT::decompressPrefix(srcBuffer, srcSize, dstBuffer, targetSize, dstCapacity);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(decompression_timer, t_start, t_end);
+		int offset = blockIdx * params.block_size;
 		dstBuffer += offset;
 	}
-	decSize = _params.block_size;
-	return decSize;
+	if(decodedSize) {
+		*decodedSize = decSize > 0 ? decSize : 0;
+	}
+	/* a short result means the (last) stripe ended before the target, i.e. all of it was decoded; it must still
+	 * reach into the block, and then the block is its short tail
+	 */
+	int offset = blockIdx * params.block_size;
+	if(decSize <= offset) {
+		std::cout << "ERROR: MBCDecompressor::decompressBlock, decompressPrefix failed" << std::endl;
+		return -1;
+	}
+	StatsShard& shard = gStats.local();
+	shard.mbc_block_decodes++;
+	shard.mbc_decoded_fraction += decSize < targetSize ? 1.0 : (double) decSize / stripeSize;
+	STATS_NOW(t_block_end);
+	STATS_RECORD_LATENCY(decompress_block_histogram, t_block_start, t_block_end);
+	return decSize < targetSize ? decSize - offset : params.block_size;
 }
 
-RACDecompressor::RACDecompressor(CompressionParameter params) : Decompressor(params) {
+RACDecompressorBase::RACDecompressorBase(CompressionParameter params) : Decompressor(params) {
 	_mbc_enable = false;
 	_rac_enable = true;
 	_algorithm = RAC;
@@ -170,35 +296,243 @@ RACDecompressor::RACDecompressor(CompressionParameter params) : Decompressor(par
 	}
 	_dict_buffer = new char[_params.max_dict];
 	_dict_buffer_size = _params.max_dict;
+	_lazy_first = 0;
+	_lazy_ready = NULL;
 }
 
-RACDecompressor::~RACDecompressor() {}
+RACDecompressorBase::~RACDecompressorBase() {
+	if(_dict_buffer) {
+		delete [] _dict_buffer;
+		_dict_buffer = NULL;
+	}
+	if(_lazy_ready) {
+		delete [] _lazy_ready;
+		_lazy_ready = NULL;
+	}
+}
 
-char* RACDecompressor::getDictBuffer() {
+char* RACDecompressorBase::getDictBuffer() {
 	return _dict_buffer;
 }
 
-int RACDecompressor::getDictBufferSize() {
+int RACDecompressorBase::getDictBufferSize() {
 	return _dict_buffer_size;
 }
 
-int RACDecompressor::decompressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity) {
-	int dstSize = 0;
-	int blockSize = _params.block_size;
-	const char* p = srcBuffer;
-	int dictSize = -1;
-	memcpy(&dictSize, p, sizeof(int));
+int RACDecompressorBase::inlineDictSize(const char* stripeHeader) {
+	int dictSize = 0;
+	memcpy(&dictSize, stripeHeader, sizeof(int));
+	return dictSize > 0 ? dictSize : 0;
+}
+
+bool RACDecompressorBase::stripeDictionary(const char* stripeHeader, const char* &dict, int &dictSize, int &sharedId) {
+	int dictField = 0;
+	memcpy(&dictField, stripeHeader, sizeof(int));
+	if(dictField >= 0) {
+		dict = stripeHeader + sizeof(int);
+		dictSize = dictField;
+		sharedId = -1;
+		return true;
+	}
+	sharedId = -(dictField+1);
+	bool loaded = sharedId < _shared_dicts.size();
+	if(loaded && sharedId >= _lazy_first && _lazy_ready && !_lazy_ready[sharedId - _lazy_first].load(std::memory_order_acquire)) {
+		loaded = loadLazyDictionary(sharedId);
+	}
+	if(!loaded) {
+		std::cout << "ERROR: RACDecompressor, stripe refers to shared dictionary " << sharedId << " that is not loaded" << std::endl;
+		return false;
+	}
+	dict = _shared_dicts[sharedId].data();
+	dictSize = _shared_dicts[sharedId].size();
+	return true;
+}
+
+bool RACDecompressorBase::loadLazyDictionary(int sharedId) {
+	std::lock_guard<std::mutex> guard(_lazy_lock);
+	int i = sharedId - _lazy_first;
+	if(_lazy_ready[i].load(std::memory_order_relaxed)) {
+		return true;
+	}
+	std::string& dict = _shared_dicts[sharedId];
+	if(!dict.empty() && !_lazy_read(&dict[0], dict.size(), _lazy_pos[i])) {
+		return false;
+	}
+	prepareSharedDictionary(sharedId);
+	_lazy_ready[i].store(true, std::memory_order_release);
+	return true;
+}
+
+void RACDecompressorBase::prepareSharedDictionary(int sharedId) {}
+
+bool RACDecompressorBase::addLazyDictionaries(const char* index, int indexSize, long long int dictPos, std::function<bool(char*, int, long long int)> read) {
+	if(_lazy_ready) {
+		std::cout << "ERROR: RACDecompressor::addLazyDictionaries, lazy dictionaries are registered already" << std::endl;
+		return false;
+	}
+	int nDicts = -1;
+	if(indexSize >= sizeof(int)) {
+		memcpy(&nDicts, index, sizeof(int));
+	}
+	if(nDicts < 0 || indexSize != sizeof(int) + (long long int) nDicts * sizeof(int)) {
+		std::cout << "ERROR: RACDecompressor::addLazyDictionaries, dictionary index is truncated" << std::endl;
+		return false;
+	}
+	for(int i = 0; i < nDicts; ++i) {
+		int dictSize = -1;
+		memcpy(&dictSize, index + sizeof(int) + i * sizeof(int), sizeof(int));
+		if(dictSize < 0) {
+			std::cout << "ERROR: RACDecompressor::addLazyDictionaries, dictionary index is corrupt" << std::endl;
+			return false;
+		}
+	}
+	if(nDicts == 0) {
+		return true;
+	}
+	_lazy_first = _shared_dicts.size();
+	_lazy_pos.resize(nDicts);
+	_lazy_ready = new std::atomic<bool>[nDicts];
+	_lazy_read = read;
+	for(int i = 0; i < nDicts; ++i) {
+		int dictSize = 0;
+		memcpy(&dictSize, index + sizeof(int) + i * sizeof(int), sizeof(int));
+		/* sized now, so readers never see _shared_dicts move; the bytes come in loadLazyDictionary */
+		_shared_dicts.push_back(std::string(dictSize, '\0'));
+		_lazy_pos[i] = dictPos;
+		_lazy_ready[i].store(false);
+		dictPos += dictSize;
+	}
+	return true;
+}
+
+bool RACDecompressorBase::loadSharedDictionaries(const char* section, int sectionSize) {
+	if(_lazy_ready) {
+		std::cout << "ERROR: RACDecompressor::loadSharedDictionaries, lazy dictionaries must be registered last" << std::endl;
+		return false;
+	}
+	int nLoaded = _shared_dicts.size();
+	const char* p = section;
+	const char* end = section + sectionSize;
+	int nDicts = 0;
+	if(sectionSize < sizeof(int)) {
+		return false;
+	}
+	memcpy(&nDicts, p, sizeof(int));
 	p += sizeof(int);
-	if(!_dict_buffer || _dict_buffer_size < dictSize) {
-		std::cout << "WARNING: RACDecompressor::decompressStripe, recreating dictionary buffer" << std::endl;
-		if(_dict_buffer) {
-			delete [] _dict_buffer;
+	for(int i = 0; i < nDicts; ++i) {
+		int dictSize = -1;
+		if(end - p < sizeof(int)) {
+			break;
 		}
-		_dict_buffer = new char[dictSize];
-		_dict_buffer_size = dictSize;
+		memcpy(&dictSize, p, sizeof(int));
+		p += sizeof(int);
+		if(dictSize < 0 || end - p < dictSize) {
+			break;
+		}
+		_shared_dicts.push_back(std::string(p, dictSize));
+		p += dictSize;
+	}
+	if(_shared_dicts.size() != nLoaded + nDicts) {
+		std::cout << "ERROR: RACDecompressor::loadSharedDictionaries, dictionary section is truncated" << std::endl;
+		_shared_dicts.resize(nLoaded);
+		return false;
+	}
+	return true;
+}
+
+int RACDecompressorBase::getNumberOfSharedDictionaries() {
+	return _shared_dicts.size();
+}
+
+int RACDecompressorBase::stripeHeaderSize(const char* stripeHeader) {
+	int dictSize = inlineDictSize(stripeHeader);
+	int nBlocks = 0;
+	memcpy(&nBlocks, stripeHeader+sizeof(int)+dictSize, sizeof(int));
+	return sizeof(int) + dictSize + sizeof(int) + nBlocks * sizeof(StripeEntry);
+}
+
+bool RACDecompressorBase::getEntry(const char* stripeHeader, int blockIdx, StripeEntry& entry) {
+	int dictSize = inlineDictSize(stripeHeader);
+	const char* p = stripeHeader + sizeof(int) + dictSize;
+	int nBlocks = 0;
+	memcpy(&nBlocks, p, sizeof(int));
+	if(blockIdx < 0 || blockIdx >= nBlocks) {
+		return false;
+	}
+	memcpy(&entry, p+sizeof(int)+blockIdx*sizeof(StripeEntry), sizeof(StripeEntry));
+	return true;
+}
+
+template<class CodecT>
+RACDecompressorT<CodecT>::RACDecompressorT(CompressionParameter params) : RACDecompressorBase(params) {
+	if(_params.codec != CodecT::codec) {
+		std::cout << "WARNING: RACDecompressor, params.codec does not match the codec of the decompressor" << std::endl;
+		_params.codec = CodecT::codec;
+	}
+}
+
+template<class CodecT>
+RACDecompressorT<CodecT>::~RACDecompressorT() {
+	freeSharedDDicts();
+}
+
+template<class CodecT>
+void RACDecompressorT<CodecT>::freeSharedDDicts() {
+	for(int i = 0; i < _shared_ddicts.size(); ++i) {
+		if(_shared_ddicts[i]) {
+			CodecT::freeDDict(_shared_ddicts[i]);
+		}
+	}
+	_shared_ddicts.clear();
+}
+
+template<class CodecT>
+bool RACDecompressorT<CodecT>::loadSharedDictionaries(const char* section, int sectionSize) {
+	bool ok = RACDecompressorBase::loadSharedDictionaries(section, sectionSize);
+	/* every stripe of a shard decodes against the same dictionary, so it is prepared once per file */
+	for(int i = _shared_ddicts.size(); i < _shared_dicts.size(); ++i) {
+		_shared_ddicts.push_back(CodecT::createDDict(_shared_dicts[i].data(), _shared_dicts[i].size()));
+	}
+	return ok;
+}
+
+template<class CodecT>
+bool RACDecompressorT<CodecT>::addLazyDictionaries(const char* index, int indexSize, long long int dictPos, std::function<bool(char*, int, long long int)> read) {
+	bool ok = RACDecompressorBase::addLazyDictionaries(index, indexSize, dictPos, read);
+	/* the slots exist up front; each is prepared when its dictionary is first loaded */
+	_shared_ddicts.resize(_shared_dicts.size(), NULL);
+	return ok;
+}
+
+template<class CodecT>
+void RACDecompressorT<CodecT>::prepareSharedDictionary(int sharedId) {
+	_shared_ddicts[sharedId] = CodecT::createDDict(_shared_dicts[sharedId].data(), _shared_dicts[sharedId].size());
+}
+
+template<class CodecT>
+int RACDecompressorT<CodecT>::decompressStripe(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity) {
+	STATS_NOW(t_stripe_start);
+	int dstSize = 0;
+	const char* dict = NULL;
+	int dictSize = 0;
+	int sharedId = -1;
+	if(!stripeDictionary(srcBuffer, dict, dictSize, sharedId)) {
+		return -1;
+	}
+	const char* p = srcBuffer + sizeof(int);
+	if(sharedId < 0) {
+		if(!_dict_buffer || _dict_buffer_size < dictSize) {
+			std::cout << "WARNING: RACDecompressor::decompressStripe, recreating dictionary buffer" << std::endl;
+			if(_dict_buffer) {
+				delete [] _dict_buffer;
+			}
+			_dict_buffer = new char[dictSize];
+			_dict_buffer_size = dictSize;
+		}
+		memcpy(_dict_buffer, p, dictSize);
+		dict = _dict_buffer;
+		p += dictSize;
 	}
-	memcpy(_dict_buffer, p, dictSize);
-	p += dictSize;
 	int nBlocks = -1;
 	memcpy(&nBlocks, p, sizeof(int));
 	p += sizeof(int);
@@ -212,42 +546,45 @@ int RACDecompressor::decompressStripe(const char* srcBuffer, const int srcSize,
 	
 	int decompressedSize = 0;
 	char* dstPtr = dstBuffer;
+	typename CodecT::DDict* ddict = sharedId >= 0 ? _shared_ddicts[sharedId] : CodecT::createDDict(dict, dictSize);
 	for(int i = 0; i < nBlocks; ++i) {
 		if(entries[i].compressedBlockSize == entries[i].rawBlockSize) {
 			memcpy(dstPtr, p, entries[i].rawBlockSize);
 			decompressedSize = entries[i].rawBlockSize;
 		} else {
-			std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-			decompressedSize = LZ4_decompress_safe_usingDict((const char*) p, dstPtr, entries[i].compressedBlockSize, blockSize, _dict_buffer, dictSize);
-			std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-			gStats.decompression_timer += t_end - t_start;
+			STATS_NOW(t_start);
+			decompressedSize = decodeBlock((const char*) p, entries[i].compressedBlockSize, dstPtr, entries[i].rawBlockSize, dict, dictSize, ddict);
+			STATS_NOW(t_end);
+			STATS_ADD_TIME(decompression_timer, t_start, t_end);
 		}
 		p += entries[i].compressedBlockSize;
 		dstPtr += decompressedSize;
 		dstSize += decompressedSize;
 	}
+	if(ddict && sharedId < 0) {
+		CodecT::freeDDict(ddict);
+	}
 //	if(dstSize != dstCapacity) {
 //		std::cout << "ERROR: RACDecompressor::decompressStripe, dstSize != dstCapacity" << std::endl;
 //	}
+	STATS_NOW(t_stripe_end);
+	STATS_RECORD_LATENCY(decompress_stripe_histogram, t_stripe_start, t_stripe_end);
 	return dstSize;
 }
 
-int RACDecompressor::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx) {
+template<class CodecT>
+int RACDecompressorT<CodecT>::decompressBlock(const char* srcBuffer, const int srcSize, char* &dstBuffer, int dstCapacity, int blockIdx, int* decodedSize) {
+	STATS_NOW(t_block_start);
 	int dstSize = 0;
 	int blockSize = _params.block_size;
-	const char* p = srcBuffer;
+	// decode against the dictionary in place so that concurrent readers never share _dict_buffer
+	const char* dict = NULL;
 	int dictSize = 0;
-	memcpy(&dictSize, p, sizeof(int));
-	p += sizeof(int);
-	if(!_dict_buffer || _dict_buffer_size < dictSize) {
-		if(_dict_buffer) {
-			delete [] _dict_buffer;
-		}
-		_dict_buffer = new char[dictSize];
-		_dict_buffer_size = dictSize;
+	int sharedId = -1;
+	if(!stripeDictionary(srcBuffer, dict, dictSize, sharedId)) {
+		return -1;
 	}
-	memcpy(_dict_buffer, p, dictSize);
-	p += dictSize;
+	const char* p = srcBuffer + sizeof(int) + inlineDictSize(srcBuffer);
 	int nBlocks = 0;
 	memcpy(&nBlocks, p, sizeof(int));
 	p += sizeof(int);
@@ -261,16 +598,100 @@ int RACDecompressor::decompressBlock(const char* srcBuffer, const int srcSize, c
 		memcpy(dstBuffer, p+offset, entry.rawBlockSize);
 		decompressedSize = entry.rawBlockSize;
 	} else {
-		std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-		decompressedSize = LZ4_decompress_safe_usingDict((const char*) p+offset, dstBuffer, entry.compressedBlockSize, blockSize, _dict_buffer, dictSize);
-		std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::system_clock::now();
-		gStats.decompression_timer += t_end - t_start;
+		STATS_NOW(t_start);
+		decompressedSize = decodeBlock((const char*) p+offset, entry.compressedBlockSize, dstBuffer, blockSize, dict, dictSize, sharedId >= 0 ? _shared_ddicts[sharedId] : NULL);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(decompression_timer, t_start, t_end);
 	}
 //	if(dstSize != blockSize) {
 //		std::cout << "ERROR: RACDecompressor::decompressBlock, dstSize != block" << std::endl;
 //	}
 	dstSize = decompressedSize;
+	if(decodedSize) {
+		*decodedSize = decompressedSize > 0 ? decompressedSize : 0;
+	}
+	STATS_NOW(t_block_end);
+	STATS_RECORD_LATENCY(decompress_block_histogram, t_block_start, t_block_end);
 	return dstSize;
 }
 
+template<class CodecT>
+int RACDecompressorT<CodecT>::decompressBlocks(const char* srcBuffer, const int srcSize, const std::vector<int>& blockIdxs, const std::vector<char*>& dstBuffers, std::vector<int>& dstSizes) {
+	STATS_NOW(t_blocks_start);
+	int blockSize = _params.block_size;
+	const char* dict = NULL;
+	int dictSize = 0;
+	int sharedId = -1;
+	dstSizes.assign(blockIdxs.size(), -1);
+	if(!stripeDictionary(srcBuffer, dict, dictSize, sharedId)) {
+		return 0;
+	}
+	const char* p = srcBuffer + sizeof(int) + inlineDictSize(srcBuffer);
+	int nBlocks = 0;
+	memcpy(&nBlocks, p, sizeof(int));
+	p += sizeof(int);
+	const char* entries = p;
+	p += nBlocks*sizeof(StripeEntry);
+
+	int nDecoded = 0;
+	typename CodecT::DDict* ddict = sharedId >= 0 ? _shared_ddicts[sharedId] : blockIdxs.size() > 1 ? CodecT::createDDict(dict, dictSize) : NULL;
+	for(int i = 0; i < blockIdxs.size(); ++i) {
+		dstSizes[i] = -1;
+		if(blockIdxs[i] < 0 || blockIdxs[i] >= nBlocks) {
+			std::cout << "ERROR: RACDecompressor::decompressBlocks, blockIdx is not within range" << std::endl;
+			continue;
+		}
+		StripeEntry entry;
+		memcpy(&entry, entries+blockIdxs[i]*sizeof(StripeEntry), sizeof(StripeEntry));
+		const char* src = p + entry.offsetOfCompressedData;
+		if(entry.compressedBlockSize == entry.rawBlockSize) {
+			memcpy(dstBuffers[i], src, entry.rawBlockSize);
+			dstSizes[i] = entry.rawBlockSize;
+		} else {
+			STATS_NOW(t_start);
+			dstSizes[i] = decodeBlock(src, entry.compressedBlockSize, dstBuffers[i], blockSize, dict, dictSize, ddict);
+			STATS_NOW(t_end);
+			STATS_ADD_TIME(decompression_timer, t_start, t_end);
+		}
+		if(dstSizes[i] >= 0) {
+			nDecoded++;
+		}
+	}
+	if(ddict && sharedId < 0) {
+		CodecT::freeDDict(ddict);
+	}
+	STATS_NOW(t_blocks_end);
+	STATS_RECORD_LATENCY(decompress_block_histogram, t_blocks_start, t_blocks_end);
+	return nDecoded;
+}
+
+template<class CodecT>
+int RACDecompressorT<CodecT>::decompressEntry(const char* stripeHeader, const StripeEntry& entry, const char* blockData, char* dstBuffer, int dstCapacity) {
+	STATS_NOW(t_block_start);
+	int decompressedSize = 0;
+	if(entry.compressedBlockSize == entry.rawBlockSize) {
+		memcpy(dstBuffer, blockData, entry.rawBlockSize);
+		decompressedSize = entry.rawBlockSize;
+	} else {
+		const char* dict = NULL;
+		int dictSize = 0;
+		int sharedId = -1;
+		if(!stripeDictionary(stripeHeader, dict, dictSize, sharedId)) {
+			return -1;
+		}
+		STATS_NOW(t_start);
+		decompressedSize = decodeBlock(blockData, entry.compressedBlockSize, dstBuffer, dstCapacity, dict, dictSize, sharedId >= 0 ? _shared_ddicts[sharedId] : NULL);
+		STATS_NOW(t_end);
+		STATS_ADD_TIME(decompression_timer, t_start, t_end);
+	}
+	STATS_NOW(t_block_end);
+	STATS_RECORD_LATENCY(decompress_block_histogram, t_block_start, t_block_end);
+	return decompressedSize;
+}
+
+template<class CodecT>
+int RACDecompressorT<CodecT>::decodeBlock(const char* src, int srcSize, char* dst, int dstCapacity, const char* dict, int dictSize, const typename CodecT::DDict* ddict) {
+	return CodecT::decompressUsingDict(src, srcSize, dst, dstCapacity, dict, dictSize, ddict);
+}
+
 #endif
@@ -1,11 +1,25 @@
 #ifndef FILER_H
 #define FILER_H
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "common.h"
 #include "compressor.hpp"
 #include "decompressor.hpp"
+#include "reader.hpp"
+#include "cache.hpp"
+#include "access.hpp"
+#include "trace.hpp"
 
 class Filer {
 private:
@@ -17,19 +31,110 @@ private:
 	int _buffer_in_size;
 	int _buffer_out_size;
 	CompressionAlgorithm _algorithm;
-	std::string _dictionary_algorithm;
+	DictionaryAlgorithm _dictionary_algorithm;
 	CompressionParameter _params;
 	Compressor* _compressor;
 	Decompressor* _decompressor;
+	int _number_of_threads;
+	IOEngine _io_engine;
+	double _target_qps;
+	ArrivalProcess _arrival;
+	long long int _cache_size;
+	CachePolicy _cache_policy;
+	AccessParameter _access;
+	std::string _trace_name;
+	TraceUnit _trace_unit;
+	ReplayMode _replay_mode;
+	int _shared_dictionaries;
+	double _dictionary_drift;
+	bool _dictionary_dedup;
+	TrainerParameter _trainer;
+	std::vector<std::string> _shared_dicts; // file-level RAC dictionaries of the file being compressed
+	std::vector<char> _dictionary_section; // the dictionaries as laid out in the header of the file being read or written
+	std::vector<std::string> _dedup_dicts; // distinct RAC stripe dictionaries of the file being compressed, in order of first use
+	std::unordered_multimap<size_t, int> _dedup_index; // content hash of a stripe dictionary -> its index in _dedup_dicts
+	std::vector<char> _dictionary_index; // [int nDicts]([int dictSize] x nDicts) of the deduplicated dictionaries after the payload of the file being read
+	long long int _dictionary_pos; // file offset of the first of those dictionaries
+	std::mutex _dictionary_lock; // readers of different threads load deduplicated dictionaries through readDictionaryRange
+	long long int _io_bytes;
+	const char* _map_base;
+	Compressor* createCompressor();
+	/* Compress stripes of [srcBuffer, srcBuffer+srcSize) into fixed-size slots of dstBuffer, claiming runs of
+	 * stripesPerRun contiguous stripes from next and compressing each run in order.
+	 */
+	void compressWorker(Compressor* compressor, const char* srcBuffer, int srcSize, int firstStripe, int stripesPerRun, char* dstBuffer, int slotSize, int* cmpSizes, std::atomic<int>* next);
+	/* Train _shared_dictionaries RAC dictionaries, one per contiguous shard of the nStripes stripes of _fi, each from
+	 * blocks sampled evenly over its shard, and lay them out in _dictionary_section.
+	 */
+	void trainSharedDictionaries(int nStripes);
+	// lay dicts out as a dictionary section [int nDicts]([int dictSize][dict] x nDicts) at the end of section
+	static void appendDictionarySection(const std::vector<std::string>& dicts, std::vector<char>& section);
+	// lay dicts out indexed, [int nDicts]([int dictSize] x nDicts)(dict x nDicts), so a reader can fetch any one alone
+	static void appendDictionaryIndex(const std::vector<std::string>& dicts, std::vector<char>& section);
+	/* Move the dictionary of the compressed RAC stripe at stripeBuffer into _dedup_dicts, unless an identical one is
+	 * there already, and leave the stripe referring to it by id; returns the new size of the stripe.
+	 */
+	int dedupStripeDictionary(char* stripeBuffer, int cmpSize);
+	// take the dictionary of the compressed RAC stripe at stripeBuffer out of the stats before it is stored raw
+	void uncountStripeDictionary(const char* stripeBuffer);
+	// point compressor at the shared dictionary of the shard stripeIdx falls in; no-op without shared dictionaries
+	void selectSharedDictionary(Compressor* compressor, int stripeIdx, int nStripes);
+	/* Keep the dictionary section that follows the stripe headers of a file header for createDecompressor, and read
+	 * the index of the deduplicated dictionaries after the payload, if any; those are fetched when first used.
+	 */
+	void readDictionarySection(const char* hdrBuffer, int hdrSize);
+	// read size bytes of the open file at pos with pread (or from the mapping), from any thread; counts them in _io_bytes
+	bool readDictionaryRange(char* buffer, int size, long long int pos);
+	Decompressor* createDecompressor();
+	// decompress the stripes of one batch; stripes[0] starts at srcBuffer and stripe i is written to dstBuffer + i * stripeSize
+	void decompressWorker(Decompressor* decompressor, const StripeHeader* stripes, int nStripes, const char* srcBuffer, char* dstBuffer, int* decSizes, std::atomic<int>* next);
+	const char* readStripe(const StripeHeader& h, int hdrSize);
+	// fetch size bytes at file offset pos into buffer, or address them in the mapping; counts the bytes in _io_bytes
+	const char* readRange(long long int pos, int size, char* buffer);
+	// issue nReads block reads drawn from _access against reader and record their latency in stats
+	void readWorker(CompressedFileReader* reader, long long int nReads, ReadThreadStats* stats);
+	// measured reads of the random-read workloads: _access.number_of_reads, or one per block of the file
+	long long int numberOfReads(long long int nBlocks);
+	// issue the unmeasured warm-up reads of _access against reader
+	void warmUp(CompressedFileReader* reader);
+	// claim requests from next, wait for their scheduled arrival and record the response time measured from that arrival; counts the successful reads
+	void openLoopWorker(CompressedFileReader* reader, const std::vector<long long int>* blocks, const std::vector<double>* arrivals, std::chrono::time_point<std::chrono::steady_clock> t_start, std::atomic<long long int>* next, LatencyHistogram* latencies, long long int* reads, long long int* bytes);
+	// claim trace records from next, read the byte range of each one and record its latency
+	void replayWorker(CompressedFileReader* reader, const std::vector<TraceRecord>* records, std::chrono::time_point<std::chrono::steady_clock> t_start, std::atomic<long long int>* next, LatencyHistogram* latencies, long long int* blocks, long long int* bytes);
+	bool mapFile(std::string fi_name);
+	void unmapFile();
 public:
 	Filer();
 	Filer(CompressionAlgorithm algorithm);
 	virtual ~Filer();
 	void init(GlobalParams params);
+	void setNumberOfThreads(int nThreads);
+	void setIOEngine(IOEngine engine);
+	void setLoadProfile(double targetQPS, ArrivalProcess arrival);
+	// cache up to capacity bytes of decoded SBC/MBC stripes or RAC stripe dictionaries in decompressBlock; 0 disables the cache
+	void setStripeCache(long long int capacity, CachePolicy policy);
+	// choose which blocks the random-read workloads visit, how many and with which seed
+	void setAccessPattern(AccessParameter access);
+	// the trace replayTrace plays back, and whether offsets are bytes or blocks
+	void setTrace(std::string trace_name, TraceUnit unit, ReplayMode mode);
+	// RAC trains nDicts dictionaries for the whole file and stores them once in its header; 0 trains one per stripe
+	void setSharedDictionaries(int nDicts);
+	/* RAC reuses the previous stripe's dictionary until a probe compresses threshold (a fraction) worse; 0 trains
+	 * one per stripe. Reuse stays within runs of at least DICT_DRIFT_RUN stripes, so any number of threads writes
+	 * the same file.
+	 */
+	void setDictionaryDrift(double threshold);
+	// RAC stores identical stripe dictionaries once, after the payload, and stripes refer to them by id; off by default
+	void setDictionaryDedup(bool enable);
+	// threads, FastCover knobs, sampling and time budget of the RAC dictionary trainer
+	void setTrainerParameter(TrainerParameter trainer);
 	int stripeCompressBound(int stripeSize);
 	long long int compressFile(std::string fi_name, std::string fo_name);
 	long long int decompressFile(std::string fi_name, std::string fo_name);
 	std::vector<int> decompressBlock(std::string fi_name, std::string fo_name);
+	long long int concurrentDecompressBlock(std::string fi_name);
+	long long int openLoopDecompressBlock(std::string fi_name);
+	long long int replayTrace(std::string fi_name);
 };
 
 Filer::Filer() {
@@ -44,8 +149,27 @@ Filer::Filer() {
 	_params.max_dict = -1;
 	_params.k = -1;
 	_params.d = -1;
+	_params.codec = LZ4Codec;
+	_params.level = COMPRESSION_LEVEL;
+	_params.acceleration = LZ4_ACCELERATION;
 	_compressor = NULL;
 	_decompressor = NULL;
+	_number_of_threads = NUMBER_OF_THREADS;
+	_io_engine = StdioEngine;
+	_target_qps = TARGET_QPS;
+	_arrival = PoissonArrival;
+	_cache_size = CACHE_SIZE;
+	_cache_policy = LRUCache;
+	_access = defaultAccessParameter();
+	_trace_unit = ByteTrace;
+	_replay_mode = FastReplay;
+	_shared_dictionaries = SHARED_DICTIONARIES;
+	_dictionary_drift = DICT_DRIFT;
+	_dictionary_dedup = DICT_DEDUP;
+	_trainer = defaultTrainerParameter();
+	_dictionary_pos = 0;
+	_io_bytes = 0;
+	_map_base = NULL;
 }
 
 Filer::Filer(CompressionAlgorithm algorithm) {
@@ -56,30 +180,50 @@ Filer::Filer(CompressionAlgorithm algorithm) {
 	_buffer_out = NULL;
 	_fi = NULL;
 	_fo = NULL;
+	_dictionary_algorithm = RollingKmer;
+	_number_of_threads = NUMBER_OF_THREADS;
+	_io_engine = StdioEngine;
+	_target_qps = TARGET_QPS;
+	_arrival = PoissonArrival;
+	_cache_size = CACHE_SIZE;
+	_cache_policy = LRUCache;
+	_access = defaultAccessParameter();
+	_trace_unit = ByteTrace;
+	_replay_mode = FastReplay;
+	_shared_dictionaries = SHARED_DICTIONARIES;
+	_dictionary_drift = DICT_DRIFT;
+	_dictionary_dedup = DICT_DEDUP;
+	_trainer = defaultTrainerParameter();
+	_dictionary_pos = 0;
+	_io_bytes = 0;
+	_map_base = NULL;
+	_params.codec = LZ4Codec;
+	_params.level = COMPRESSION_LEVEL;
+	_params.acceleration = LZ4_ACCELERATION;
 	if(algorithm == SBC) {
 		_params.block_size = SBC_BLOCK_SIZE;
 		_params.number_of_blocks = SBC_NUMBER_OF_BLOCKS;
 		_params.max_dict = 0;
 		_params.k = 0;
 		_params.d = 0;
-		_compressor = new SBCCompressor(_params);
-		_decompressor = new SBCDecompressor(_params);
+		_compressor = Compressor::create(SBC, _params);
+		_decompressor = Decompressor::create(SBC, _params);
 	} else if(algorithm == MBC) {
 		_params.block_size = MBC_BLOCK_SIZE;
 		_params.number_of_blocks = MBC_NUMBER_OF_BLOCKS;
 		_params.max_dict = 0;
 		_params.k = 0;
 		_params.d = 0;
-		_compressor = new MBCCompressor(_params);
-		_decompressor = new MBCDecompressor(_params);
+		_compressor = Compressor::create(MBC, _params);
+		_decompressor = Decompressor::create(MBC, _params);
 	} else if(algorithm == RAC) {
 		_params.block_size = RAC_BLOCK_SIZE;
 		_params.number_of_blocks = RAC_NUMBER_OF_BLOCKS;
 		_params.max_dict = RAC_MAX_DICT;
 		_params.k = RAC_K;
 		_params.d = RAC_D;
-		_compressor = new RACCompressor(_params);
-		_decompressor = new RACDecompressor(_params);
+		_compressor = Compressor::create(RAC, _params);
+		_decompressor = Decompressor::create(RAC, _params);
 	}
 }
 
@@ -92,6 +236,7 @@ Filer::~Filer() {
 		fclose(_fo);
 		_fo = NULL;
 	}
+	unmapFile();
 	if(_buffer_in) {
 		delete [] _buffer_in;
 		_buffer_in = NULL;
@@ -124,24 +269,350 @@ void Filer::init(GlobalParams params) {
 	_params.max_dict = params.max_dict;
 	_params.k = params.segment_size;
 	_params.d = params.kmer_size;
+	_params.codec = params.codec;
+	_params.level = params.level;
+	_params.acceleration = params.acceleration;
+	setNumberOfThreads(params.number_of_threads);
+	setIOEngine(params.io_engine);
+	setLoadProfile(params.target_qps, params.arrival);
+	setStripeCache(params.cache_size, params.cache_policy);
+	setAccessPattern(params.access);
+	setTrace(params.trace_name, params.trace_unit, params.replay_mode);
+	setSharedDictionaries(params.shared_dictionaries);
+	setDictionaryDrift(params.dictionary_drift);
+	setDictionaryDedup(params.dictionary_dedup);
+	setTrainerParameter(params.trainer);
 	if(params.algorithm == SBC) {
 		if(params.number_of_blocks != 1 || params.max_dict != 0 || params.segment_size != 0 || params.kmer_size != 0) {
 			std::cout << "ERROR: invalid SBC params" << std::endl;
 		}
-		_compressor = new SBCCompressor(_params);
-		_decompressor = new SBCDecompressor(_params);
+		_compressor = Compressor::create(SBC, _params);
+		_decompressor = Decompressor::create(SBC, _params);
 	} else if(params.algorithm == MBC) {
 		if(params.number_of_blocks <= 1 || params.max_dict != 0 || params.segment_size != 0 || params.kmer_size != 0) {
 			std::cout << "ERROR: invalid MBC params" << std::endl;
 		}
-		_compressor = new MBCCompressor(_params);
-		_decompressor = new MBCDecompressor(_params);
+		_compressor = Compressor::create(MBC, _params);
+		_decompressor = Decompressor::create(MBC, _params);
 	} else if(params.algorithm == RAC) {
-		if(params.max_dict == 0 || params.segment_size == 0 || params.kmer_size == 0) {
+		if(params.max_dict == 0 || params.segment_size < 0 || params.kmer_size < 0) {
 			std::cout << "ERROR: invalid RAC params" << std::endl;
 		}
-		_compressor = new RACCompressor(_params);
-		_decompressor = new RACDecompressor(_params);
+		_compressor = Compressor::create(RAC, _params);
+		_decompressor = Decompressor::create(RAC, _params);
+	}
+}
+
+void Filer::setNumberOfThreads(int nThreads) {
+	if(nThreads < 1) {
+		std::cout << "WARNING: Filer::setNumberOfThreads, nThreads < 1, use 1 thread instead" << std::endl;
+		nThreads = 1;
+	}
+	_number_of_threads = nThreads;
+}
+
+void Filer::setIOEngine(IOEngine engine) {
+	_io_engine = engine;
+}
+
+void Filer::setStripeCache(long long int capacity, CachePolicy policy) {
+	if(capacity < 0) {
+		std::cout << "WARNING: Filer::setStripeCache, capacity < 0, disable the cache instead" << std::endl;
+		capacity = 0;
+	}
+	_cache_size = capacity;
+	_cache_policy = policy;
+}
+
+void Filer::setAccessPattern(AccessParameter access) {
+	if(access.number_of_reads < 0) {
+		std::cout << "WARNING: Filer::setAccessPattern, number_of_reads < 0, read as many blocks as the file has instead" << std::endl;
+		access.number_of_reads = 0;
+	}
+	if(access.warmup_reads < 0) {
+		std::cout << "WARNING: Filer::setAccessPattern, warmup_reads < 0, skip the warm-up instead" << std::endl;
+		access.warmup_reads = 0;
+	}
+	_access = access;
+}
+
+void Filer::setTrace(std::string trace_name, TraceUnit unit, ReplayMode mode) {
+	_trace_name = trace_name;
+	_trace_unit = unit;
+	_replay_mode = mode;
+}
+
+void Filer::setSharedDictionaries(int nDicts) {
+	if(nDicts < 0) {
+		std::cout << "WARNING: Filer::setSharedDictionaries, nDicts < 0, train a dictionary per stripe instead" << std::endl;
+		nDicts = 0;
+	}
+	_shared_dictionaries = nDicts;
+}
+
+void Filer::setDictionaryDrift(double threshold) {
+	if(threshold < 0) {
+		std::cout << "WARNING: Filer::setDictionaryDrift, threshold < 0, train a dictionary per stripe instead" << std::endl;
+		threshold = 0;
+	}
+	_dictionary_drift = threshold;
+}
+
+void Filer::setDictionaryDedup(bool enable) {
+	_dictionary_dedup = enable;
+}
+
+void Filer::setTrainerParameter(TrainerParameter trainer) {
+	if(trainer.threads < 1) {
+		std::cout << "WARNING: Filer::setTrainerParameter, threads < 1, train with 1 thread instead" << std::endl;
+		trainer.threads = 1;
+	}
+	if(trainer.sample_fraction <= 0 || trainer.sample_fraction > 1) {
+		std::cout << "WARNING: Filer::setTrainerParameter, sample_fraction is not in (0, 1], sample every block instead" << std::endl;
+		trainer.sample_fraction = 1;
+	}
+	if(trainer.sample_blocks < 0) {
+		std::cout << "WARNING: Filer::setTrainerParameter, sample_blocks < 0, use sample_fraction instead" << std::endl;
+		trainer.sample_blocks = 0;
+	}
+	if(trainer.budget_ms < 0) {
+		std::cout << "WARNING: Filer::setTrainerParameter, budget_ms < 0, wait for every dictionary instead" << std::endl;
+		trainer.budget_ms = 0;
+	}
+	_trainer = trainer;
+}
+
+long long int Filer::numberOfReads(long long int nBlocks) {
+	return _access.number_of_reads > 0 ? _access.number_of_reads : nBlocks;
+}
+
+void Filer::setLoadProfile(double targetQPS, ArrivalProcess arrival) {
+	if(targetQPS < 0) {
+		std::cout << "WARNING: Filer::setLoadProfile, targetQPS < 0, use closed loop instead" << std::endl;
+		targetQPS = 0;
+	}
+	_target_qps = targetQPS;
+	_arrival = arrival;
+}
+
+Compressor* Filer::createCompressor() {
+	Compressor* compressor = Compressor::create(_algorithm, _params);
+	if(compressor) {
+		compressor->setDictionaryDrift(_dictionary_drift);
+		compressor->setTrainerParameter(_trainer);
+	}
+	return compressor;
+}
+
+void Filer::trainSharedDictionaries(int nStripes) {
+	_shared_dicts.clear();
+	_dictionary_section.clear();
+	int nDicts = _shared_dictionaries < nStripes ? _shared_dictionaries : nStripes;
+	long long int stripeSize = (long long int) _params.block_size * _params.number_of_blocks;
+	int blockSize = _params.block_size;
+	long long int sampleBudget = (long long int) SHARED_DICT_SAMPLE_RATIO * _params.max_dict;
+	long long int maxSamples = sampleBudget / blockSize > 0 ? sampleBudget / blockSize : 1;
+	char* dictBuffer = new char[_params.max_dict];
+	std::vector<char> samples;
+	std::vector<size_t> sampleSizes;
+	for(int s = 0; s < nDicts; ++s) {
+		long long int lo = (long long int) s * nStripes / nDicts * stripeSize;
+		long long int hi = (long long int) (s + 1) * nStripes / nDicts * stripeSize;
+		if(hi > _file_in_size) {
+			hi = _file_in_size;
+		}
+		long long int nBlocks = (hi - lo - 1) / blockSize + 1;
+		long long int nSamples = nBlocks < maxSamples ? nBlocks : maxSamples;
+		samples.resize(nSamples * blockSize);
+		sampleSizes.clear();
+		size_t filled = 0;
+		for(long long int j = 0; j < nSamples; ++j) {
+			long long int pos = lo + nBlocks * j / nSamples * blockSize;
+			int len = hi - pos < blockSize ? hi - pos : blockSize;
+			fseek(_fi, pos, SEEK_SET);
+			size_t rsize = fread(samples.data() + filled, 1, len, _fi);
+			sampleSizes.push_back(rsize);
+			filled += rsize;
+		}
+		int dictSize = trainDictionary(dictBuffer, _params.max_dict, samples.data(), sampleSizes, _params, _dictionary_algorithm, _trainer);
+		gStats.local().total_dictionary_size += dictSize;
+		_shared_dicts.push_back(std::string(dictBuffer, dictSize));
+	}
+	delete [] dictBuffer;
+	rewind(_fi);
+	appendDictionarySection(_shared_dicts, _dictionary_section);
+}
+
+void Filer::appendDictionarySection(const std::vector<std::string>& dicts, std::vector<char>& section) {
+	int n = dicts.size();
+	section.insert(section.end(), (const char*) &n, (const char*) &n + sizeof(int));
+	for(int i = 0; i < n; ++i) {
+		int dictSize = dicts[i].size();
+		section.insert(section.end(), (const char*) &dictSize, (const char*) &dictSize + sizeof(int));
+		section.insert(section.end(), dicts[i].begin(), dicts[i].end());
+	}
+}
+
+void Filer::appendDictionaryIndex(const std::vector<std::string>& dicts, std::vector<char>& section) {
+	int n = dicts.size();
+	section.insert(section.end(), (const char*) &n, (const char*) &n + sizeof(int));
+	for(int i = 0; i < n; ++i) {
+		int dictSize = dicts[i].size();
+		section.insert(section.end(), (const char*) &dictSize, (const char*) &dictSize + sizeof(int));
+	}
+	for(int i = 0; i < n; ++i) {
+		section.insert(section.end(), dicts[i].begin(), dicts[i].end());
+	}
+}
+
+void Filer::uncountStripeDictionary(const char* stripeBuffer) {
+	int dictSize = 0;
+	memcpy(&dictSize, stripeBuffer, sizeof(int));
+	if(_algorithm == RAC && dictSize > 0) {
+		gStats.local().total_dictionary_size -= dictSize;
+	}
+}
+
+int Filer::dedupStripeDictionary(char* stripeBuffer, int cmpSize) {
+	int dictSize = 0;
+	memcpy(&dictSize, stripeBuffer, sizeof(int));
+	if(_algorithm != RAC || dictSize <= 0) {
+		return cmpSize;
+	}
+	char* dict = stripeBuffer + sizeof(int);
+	std::string content(dict, dictSize);
+	size_t hash = std::hash<std::string>()(content);
+	int idx = -1;
+	std::pair<std::unordered_multimap<size_t, int>::iterator, std::unordered_multimap<size_t, int>::iterator> range = _dedup_index.equal_range(hash);
+	for(std::unordered_multimap<size_t, int>::iterator it = range.first; it != range.second; ++it) {
+		if(_dedup_dicts[it->second] == content) {
+			idx = it->second;
+			break;
+		}
+	}
+	if(idx < 0) {
+		idx = _dedup_dicts.size();
+		_dedup_dicts.push_back(content);
+		_dedup_index.insert(std::make_pair(hash, idx));
+	} else {
+		gStats.total_deduplicated_dictionary_size += dictSize;
+	}
+	/* ids of the deduplicated dictionaries follow those of the shared ones in the header */
+	int dictField = -((int) _shared_dicts.size() + idx + 1);
+	memcpy(stripeBuffer, &dictField, sizeof(int));
+	memmove(dict, dict + dictSize, cmpSize - sizeof(int) - dictSize);
+	return cmpSize - dictSize;
+}
+
+void Filer::selectSharedDictionary(Compressor* compressor, int stripeIdx, int nStripes) {
+	if(_shared_dicts.empty()) {
+		return;
+	}
+	int id = (long long int) stripeIdx * _shared_dicts.size() / nStripes;
+	compressor->useSharedDictionary(id, _shared_dicts[id].data(), _shared_dicts[id].size());
+}
+
+void Filer::readDictionarySection(const char* hdrBuffer, int hdrSize) {
+	int nStripes = 0;
+	memcpy(&nStripes, hdrBuffer + 8 + sizeof(CompressionParameter), sizeof(int));
+	long long int sectionOffset = 8 + sizeof(CompressionParameter) + sizeof(int) + (long long int) nStripes * sizeof(StripeHeader);
+	_dictionary_section.clear();
+	if(sectionOffset < hdrSize) {
+		_dictionary_section.assign(hdrBuffer + sectionOffset, hdrBuffer + hdrSize);
+	}
+	/* the deduplicated stripe dictionaries, if any, follow the stripe of the highest offset, which is the last one;
+	 * only their index is read here
+	 */
+	_dictionary_index.clear();
+	if(nStripes <= 0 || sectionOffset > hdrSize) {
+		return;
+	}
+	StripeHeader last;
+	memcpy(&last, hdrBuffer + sectionOffset - sizeof(StripeHeader), sizeof(StripeHeader));
+	long long int indexPos = sizeof(int) + hdrSize + last.offsetOfCompressedData + last.compressedStripeSize;
+	int nDicts = -1;
+	if(indexPos >= _file_in_size) {
+		return;
+	}
+	if(!readDictionaryRange((char*) &nDicts, sizeof(int), indexPos) || nDicts < 0 || indexPos + sizeof(int) + (long long int) nDicts * sizeof(int) > _file_in_size) {
+		std::cout << "ERROR: Filer::readDictionarySection, invalid dictionary index after the payload" << std::endl;
+		return;
+	}
+	_dictionary_index.resize(sizeof(int) + nDicts * sizeof(int));
+	if(!readDictionaryRange(_dictionary_index.data(), _dictionary_index.size(), indexPos)) {
+		_dictionary_index.clear();
+		return;
+	}
+	_dictionary_pos = indexPos + _dictionary_index.size();
+}
+
+bool Filer::readDictionaryRange(char* buffer, int size, long long int pos) {
+	std::lock_guard<std::mutex> guard(_dictionary_lock);
+	_io_bytes += size;
+	if(_map_base) {
+		memcpy(buffer, _map_base + pos, size);
+		return true;
+	}
+	if(!_fi || pread(fileno(_fi), buffer, size, pos) != size) {
+		std::cout << "ERROR: Filer::readDictionaryRange, cannot read the dictionaries after the payload" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Filer::compressWorker(Compressor* compressor, const char* srcBuffer, int srcSize, int firstStripe, int stripesPerRun, char* dstBuffer, int slotSize, int* cmpSizes, std::atomic<int>* next) {
+	int stripeSize = _params.block_size * _params.number_of_blocks;
+	int nStripes = (srcSize-1)/stripeSize+1;
+	while(1) {
+		int first = next->fetch_add(1) * stripesPerRun;
+		if(first >= nStripes) {
+			break;
+		}
+		for(int i = first; i < first + stripesPerRun && i < nStripes; ++i) {
+			const char* cur = srcBuffer + (long long int) i * stripeSize;
+			char* oPtr = dstBuffer + (long long int) i * slotSize;
+			int len = srcSize - i * stripeSize < stripeSize ? srcSize - i * stripeSize : stripeSize;
+			selectSharedDictionary(compressor, firstStripe + i, (_file_in_size-1)/stripeSize+1);
+			compressor->beginStripe(firstStripe + i, i == first);
+			int cmpSize = compressor->compressStripe(cur, len, oPtr, stripeCompressBound(len), _dictionary_algorithm);
+			if(cmpSize >= len) {
+				uncountStripeDictionary(oPtr);
+				memcpy(oPtr, cur, len);
+				cmpSize = len;
+			}
+			cmpSizes[i] = cmpSize;
+		}
+	}
+}
+
+Decompressor* Filer::createDecompressor() {
+	Decompressor* decompressor = Decompressor::create(_algorithm, _params);
+	if(_algorithm == RAC && decompressor && !_dictionary_section.empty()) {
+		((RACDecompressorBase*) decompressor)->loadSharedDictionaries(_dictionary_section.data(), _dictionary_section.size());
+	}
+	if(_algorithm == RAC && decompressor && !_dictionary_index.empty()) {
+		((RACDecompressorBase*) decompressor)->addLazyDictionaries(_dictionary_index.data(), _dictionary_index.size(), _dictionary_pos, std::bind(&Filer::readDictionaryRange, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+	}
+	return decompressor;
+}
+
+void Filer::decompressWorker(Decompressor* decompressor, const StripeHeader* stripes, int nStripes, const char* srcBuffer, char* dstBuffer, int* decSizes, std::atomic<int>* next) {
+	int stripeSize = _params.block_size * _params.number_of_blocks;
+	while(1) {
+		int i = next->fetch_add(1);
+		if(i >= nStripes) {
+			break;
+		}
+		const char* iPtr = srcBuffer + (stripes[i].offsetOfCompressedData - stripes[0].offsetOfCompressedData);
+		char* oPtr = dstBuffer + (long long int) i * stripeSize;
+		int decompressedSize = 0;
+		if(stripes[i].compressedStripeSize == stripes[i].rawStripeSize) {
+			memcpy(oPtr, iPtr, stripes[i].rawStripeSize);
+			decompressedSize = stripes[i].rawStripeSize;
+		} else {
+			decompressedSize = decompressor->decompressStripe(iPtr, stripes[i].compressedStripeSize, oPtr, stripes[i].rawStripeSize);
+		}
+		decSizes[i] = decompressedSize;
 	}
 }
 
@@ -149,13 +620,14 @@ int Filer::stripeCompressBound(int srcSize) {
 	int stripeCapacity = 0;
 	int stripeSize = _params.block_size * _params.number_of_blocks;
 	if(_algorithm == SBC) {
-		stripeCapacity = LZ4_compressBound(srcSize);
+		stripeCapacity = Compressor::compressBound(_params, srcSize);
 	} else if(_algorithm == MBC) {
-		stripeCapacity = LZ4_compressBound(srcSize);
+		stripeCapacity = Compressor::compressBound(_params, srcSize);
 	} else if(_algorithm == RAC) {
 		int numberOfBlocks = (srcSize-1)/_params.block_size+1;
 		int hdrSize = sizeof(int)+_params.max_dict+sizeof(int)+numberOfBlocks*sizeof(StripeEntry);
-		int bodySize = numberOfBlocks * _params.block_size;
+		// blocks are stored raw when they do not shrink, but the last one is first compressed in place
+		int bodySize = numberOfBlocks * _params.block_size + Compressor::compressBound(_params, _params.block_size) - _params.block_size;
 		stripeCapacity = hdrSize + bodySize;
 //		stripeCapacity = 2*srcSize;
 	}
@@ -173,7 +645,17 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 	gStats.total_raw_size = _file_in_size;
 	rewind(_fi);
 	int stripeSize = _params.block_size * _params.number_of_blocks;
-	_buffer_in_size = ((BUFFER_SIZE-1)/stripeSize+1)*stripeSize;
+	/* every worker thread gets a run of about BUFFER_SIZE bytes of input for each batch; with drift, runs of at
+	 * least DICT_DRIFT_RUN stripes let dictionaries be reused, and runs start at the same stripes whatever the
+	 * number of threads, so the output is too
+	 */
+	int stripesPerRun = (BUFFER_SIZE-1)/stripeSize+1;
+	if(_algorithm == RAC && _dictionary_drift > 0 && stripesPerRun < DICT_DRIFT_RUN) {
+		stripesPerRun = DICT_DRIFT_RUN;
+	}
+	int stripesPerBatch = stripesPerRun * _number_of_threads;
+	int slotSize = stripeCompressBound(stripeSize);
+	_buffer_in_size = stripesPerBatch*stripeSize;
 	_buffer_out_size = _buffer_in_size;
 	if(_buffer_in) {
 		delete [] _buffer_in;
@@ -182,19 +664,44 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 	if(_buffer_out) {
 		delete [] _buffer_out;
 	}
-	_buffer_out = new char[2*_buffer_out_size];
+	if(_number_of_threads > 1) {
+		_buffer_out = new char[(long long int) stripesPerBatch*slotSize];
+	} else {
+		_buffer_out = new char[2*_buffer_out_size];
+	}
 	if(!_compressor) {
 		std::cout << "ERROR: Filer::compress, _compressor is invalid" << std::endl;
 	}
+	std::vector<Compressor*> compressors;
+	for(int i = 1; i < _number_of_threads; ++i) {
+		compressors.push_back(createCompressor());
+	}
+	std::vector<int> cmpSizes(stripesPerBatch);
 
 	long long int dstSize = 0;
 	int nStripes = (_file_in_size-1)/stripeSize+1;
+	_shared_dicts.clear();
+	_dictionary_section.clear();
+	_dedup_dicts.clear();
+	_dedup_index.clear();
+	gStats.total_deduplicated_dictionary_size = 0;
+	if(_algorithm == RAC && _shared_dictionaries > 0) {
+		trainSharedDictionaries(nStripes);
+	}
+	if(_compressor) {
+		/* forget the dictionaries of a previous file */
+		_compressor->useSharedDictionary(-1, NULL, 0);
+		_compressor->setDictionaryDrift(_dictionary_drift);
+		_compressor->setTrainerParameter(_trainer);
+	}
 	int hdrSize = 0;
 	hdrSize += 8; // 8 bytes for SBC/MBC/RAC
-	hdrSize += sizeof(CompressionParameter); // 20 bytes for _params
+	hdrSize += sizeof(CompressionParameter); // 32 bytes for _params
 	hdrSize += sizeof(int); // 4 bytes for the number of stripes
 	hdrSize += nStripes * sizeof(StripeHeader); // create a StripeHeader for each stripe
+	hdrSize += _dictionary_section.size(); // shared RAC dictionaries, if any
 	char* hdrBuffer = new char[hdrSize+sizeof(int)]; // sizeof(int) bytes to store the total size of header
+	memset(hdrBuffer, 0, hdrSize+sizeof(int)); // unused tag bytes must not depend on heap garbage
 	char* hdrPtr = hdrBuffer;
 	memcpy(hdrPtr, &hdrSize, sizeof(int));
 	hdrPtr += sizeof(int);
@@ -216,17 +723,49 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 	hdrPtr += sizeof(CompressionParameter);
 	memcpy(hdrPtr, &nStripes, sizeof(int));
 	hdrPtr += sizeof(int);
+	if(!_dictionary_section.empty()) {
+		memcpy(hdrPtr + nStripes * sizeof(StripeHeader), _dictionary_section.data(), _dictionary_section.size());
+	}
 	dstSize += sizeof(int); // do not forget to add 4 bytes at the beginnning of the file to represent the header size
 	dstSize += hdrSize;
 	fwrite(hdrBuffer, 1, hdrSize+sizeof(int), _fo);
 	size_t rsize = 0;
 	StripeHeader h;
 	long long int offset = 0;
+	int stripeIdx = 0;
 	while(1) {
 		rsize = fread(_buffer_in, 1, _buffer_in_size, _fi);
 		if(rsize == 0) {
 			break;
 		}
+		if(_number_of_threads > 1) {
+			/* compress the batch in parallel, then write stripes in order */
+			std::atomic<int> next(0);
+			std::vector<std::thread> workers;
+			for(int i = 0; i < compressors.size(); ++i) {
+				workers.push_back(std::thread(&Filer::compressWorker, this, compressors[i], _buffer_in, (int) rsize, stripeIdx, stripesPerRun, _buffer_out, slotSize, cmpSizes.data(), &next));
+			}
+			compressWorker(_compressor, _buffer_in, rsize, stripeIdx, stripesPerRun, _buffer_out, slotSize, cmpSizes.data(), &next);
+			for(int i = 0; i < workers.size(); ++i) {
+				workers[i].join();
+			}
+			int nBatchStripes = (rsize-1)/stripeSize+1;
+			for(int i = 0; i < nBatchStripes; ++i) {
+				int srcSize = rsize - i * stripeSize < stripeSize ? rsize - i * stripeSize : stripeSize;
+				if(_dictionary_dedup && cmpSizes[i] < srcSize) {
+					cmpSizes[i] = dedupStripeDictionary(_buffer_out + (long long int) i * slotSize, cmpSizes[i]);
+				}
+				h.offsetOfCompressedData = offset;
+				h.rawStripeSize = srcSize;
+				h.compressedStripeSize = cmpSizes[i];
+				memcpy(hdrPtr, &h, sizeof(StripeHeader));
+				hdrPtr += sizeof(StripeHeader);
+				fwrite(_buffer_out + (long long int) i * slotSize, 1, cmpSizes[i], _fo);
+				offset += cmpSizes[i];
+			}
+			stripeIdx += nBatchStripes;
+			continue;
+		}
 		const char* cur = _buffer_in;
 		const char* end = _buffer_in + rsize;
 		char* oPtr = _buffer_out;
@@ -234,13 +773,12 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 		while(cur < end) {
 			int srcSize = end - cur < stripeSize ? end - cur : stripeSize;
 			int bound = stripeCompressBound(srcSize);
-			int cmpSize = -1;
-			if(_dictionary_algorithm == "rolling-kmer") {
-				cmpSize = _compressor->compressStripe(cur, srcSize, oPtr, bound);
-			} else if(_dictionary_algorithm == "suffix-array") {
-				cmpSize = _compressor->compressStripe(cur, srcSize, oPtr, bound, "suffix-array");
-			}
+			selectSharedDictionary(_compressor, stripeIdx, nStripes);
+			_compressor->beginStripe(stripeIdx, stripeIdx % stripesPerRun == 0);
+			stripeIdx++;
+			int cmpSize = _compressor->compressStripe(cur, srcSize, oPtr, bound, _dictionary_algorithm);
 			if(cmpSize >= srcSize) {
+				uncountStripeDictionary(oPtr);
 				memcpy(oPtr, cur, srcSize);
 				cmpSize = srcSize;
 				h.offsetOfCompressedData = offset;
@@ -248,6 +786,9 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 				h.compressedStripeSize = cmpSize;
 				memcpy(hdrPtr, &h, sizeof(StripeHeader));
 			} else {
+				if(_dictionary_dedup) {
+					cmpSize = dedupStripeDictionary(oPtr, cmpSize);
+				}
 				h.offsetOfCompressedData = offset;
 				h.rawStripeSize = srcSize;
 				h.compressedStripeSize = cmpSize;
@@ -262,6 +803,16 @@ long long int Filer::compressFile(std::string fi_name, std::string fo_name) {
 		fwrite(_buffer_out, 1, wsize, _fo);
 	}
 	dstSize += offset;
+	for(int i = 0; i < compressors.size(); ++i) {
+		delete compressors[i];
+	}
+	/* with dedup, every distinct stripe dictionary is stored once, after the payload, where readers find it past the last stripe */
+	if(!_dedup_dicts.empty()) {
+		std::vector<char> trailer;
+		appendDictionaryIndex(_dedup_dicts, trailer);
+		fwrite(trailer.data(), 1, trailer.size(), _fo);
+		dstSize += trailer.size();
+	}
 
 	rewind(_fo);
 	fwrite(hdrBuffer, 1, hdrSize+sizeof(int), _fo);
@@ -301,14 +852,16 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
 	memcpy(&_params, p, sizeof(CompressionParameter));
 	if(hdrPtr[0] == 'S' && hdrPtr[1] == 'B' && hdrPtr[2] == 'C') {
 		_algorithm = SBC;
-		_decompressor = new SBCDecompressor(_params);
 	} else if(hdrPtr[0] == 'M' && hdrPtr[1] == 'B' && hdrPtr[2] == 'C') {
 		_algorithm = MBC;
-		_decompressor = new MBCDecompressor(_params);
 	} else if(hdrPtr[0] == 'R' && hdrPtr[1] == 'A' && hdrPtr[2] == 'C') {
 		_algorithm = RAC;
-		_decompressor = new RACDecompressor(_params);
 	}
+	if(_decompressor) {
+		delete _decompressor;
+	}
+	readDictionarySection(hdrBuffer, hdrSize);
+	_decompressor = createDecompressor();
 	p += sizeof(CompressionParameter);
 	int nStripes = -1;
 	memcpy(&nStripes, p, sizeof(int));
@@ -321,7 +874,8 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
 		p += sizeof(StripeHeader);
 	}
 	int stripeSize = _params.block_size * _params.number_of_blocks;
-	_buffer_out_size = ((BUFFER_SIZE-1)/stripeSize+1)*stripeSize;
+	// every worker thread decodes about BUFFER_SIZE bytes of output for each batch
+	_buffer_out_size = ((BUFFER_SIZE-1)/stripeSize+1)*stripeSize*_number_of_threads;
 	_buffer_in_size = _buffer_out_size;
 	if(_buffer_in) {
 		delete [] _buffer_in;
@@ -331,6 +885,11 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
 		delete [] _buffer_out;
 	}
 	_buffer_out = new char[_buffer_out_size*2];
+	std::vector<Decompressor*> decompressors;
+	for(int i = 1; i < _number_of_threads; ++i) {
+		decompressors.push_back(createDecompressor());
+	}
+	std::vector<int> decSizes(nStripes);
 	long long int accuInSize = 0;
 	long long int accuOutSize = 0;
 	long long int offset = 0;
@@ -342,6 +901,32 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
 		if(accuOutSize>=_buffer_out_size || i == stripeVector.size()-1) {
 			idxEnd = i;
 			int rsize = fread(_buffer_in, 1, accuInSize, _fi);
+			if(_number_of_threads > 1) {
+				/* decode the batch in parallel; stripes land in order in _buffer_out */
+				std::atomic<int> next(0);
+				std::vector<std::thread> workers;
+				int nBatchStripes = idxEnd - idxStart + 1;
+				for(int m = 0; m < decompressors.size(); ++m) {
+					workers.push_back(std::thread(&Filer::decompressWorker, this, decompressors[m], &stripeVector[idxStart], nBatchStripes, _buffer_in, _buffer_out, &decSizes[idxStart], &next));
+				}
+				decompressWorker(_decompressor, &stripeVector[idxStart], nBatchStripes, _buffer_in, _buffer_out, &decSizes[idxStart], &next);
+				for(int m = 0; m < workers.size(); ++m) {
+					workers[m].join();
+				}
+				int decSize = 0;
+				for(int m = idxStart; m <= idxEnd; ++m) {
+					if(decSizes[m] != stripeVector[m].rawStripeSize) {
+						std::cout << "ERROR: Filer::decompressFile, decompressedSize != rawStripeSize" << std::endl;
+					}
+					decSize += decSizes[m];
+				}
+				dstSize += decSize;
+				fwrite(_buffer_out, 1, decSize, _fo);
+				idxStart = idxEnd+1;
+				accuInSize = 0;
+				accuOutSize = 0;
+				continue;
+			}
 			const char* iPtr = _buffer_in;
 			char* oPtr = _buffer_out;
 			int decSize = 0;
@@ -367,6 +952,9 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
 			accuOutSize = 0;
 		} 
 	}
+	for(int i = 0; i < decompressors.size(); ++i) {
+		delete decompressors[i];
+	}
 	fclose(_fi);
 	_fi = NULL;
 
@@ -388,40 +976,62 @@ long long int Filer::decompressFile(std::string fi_name, std::string fo_name) {
  * OUTPUT: 
  */
 std::vector<int> Filer::decompressBlock(std::string fi_name, std::string fo_name) {
-	_fi = fopen(fi_name.c_str(), "rb");
-	if(!_fi) {
-		std::cout << "ERROR: Filer::Filer, _fi is invalid" << std::endl;
-	}
-	fseek(_fi, 0, SEEK_END);
-	_file_in_size = ftell(_fi);
-	gStats.total_compressed_size = _file_in_size;
-	rewind(_fi);
-
+	const char* hdrBuffer = NULL;
 	int dstSize = 0;
 	int hdrSize = -1;
-	fread(&hdrSize, sizeof(int), 1, _fi);
+	if(_io_engine == MmapEngine) {
+		if(!mapFile(fi_name)) {
+			return std::vector<int>();
+		}
+		memcpy(&hdrSize, _map_base, sizeof(int));
+		hdrBuffer = _map_base + sizeof(int);
+	} else {
+		_fi = fopen(fi_name.c_str(), "rb");
+		if(!_fi) {
+			std::cout << "ERROR: Filer::Filer, _fi is invalid" << std::endl;
+		}
+		fseek(_fi, 0, SEEK_END);
+		_file_in_size = ftell(_fi);
+		rewind(_fi);
+		fread(&hdrSize, sizeof(int), 1, _fi);
+		if(hdrSize >= 0) {
+			char* buffer = new char[hdrSize];
+			fread(buffer, 1, hdrSize, _fi);
+			hdrBuffer = buffer;
+		}
+	}
+	gStats.total_compressed_size = _file_in_size;
 	if(hdrSize < 0) {
 		std::cout << "ERROR: Filer::decompressFile, hdrSize is invalid" << std::endl;
 	}
-	char* hdrBuffer = new char[hdrSize];
-	fread(hdrBuffer, 1, hdrSize, _fi);
 	const char* hdrPtr = hdrBuffer;
 	const char* p = hdrPtr + 8;
 	memcpy(&_params, p, sizeof(CompressionParameter));
 	if(hdrPtr[0] == 'S' && hdrPtr[1] == 'B' && hdrPtr[2] == 'C') {
 		_algorithm = SBC;
-		_decompressor = new SBCDecompressor(_params);
 	} else if(hdrPtr[0] == 'M' && hdrPtr[1] == 'B' && hdrPtr[2] == 'C') {
 		_algorithm = MBC;
-		_decompressor = new MBCDecompressor(_params);
 	} else if(hdrPtr[0] == 'R' && hdrPtr[1] == 'A' && hdrPtr[2] == 'C') {
 		_algorithm = RAC;
-		_decompressor = new RACDecompressor(_params);
 	}
+	if(_decompressor) {
+		delete _decompressor;
+	}
+	readDictionarySection(hdrBuffer, hdrSize);
+	_decompressor = createDecompressor();
 	p += sizeof(CompressionParameter);
 	int nStripes = -1;
 	memcpy(&nStripes, p, sizeof(int));
 	p += sizeof(int);
+	int stripeSize = _params.block_size * _params.number_of_blocks;
+	if(!_buffer_out || _buffer_out_size < stripeSize) {
+		if(_buffer_out) {
+			delete [] _buffer_out;
+			std::cout << "WARNING: Filer::decompressBlock, _buffer_out is not valid" << std::endl;
+		}
+		_buffer_out = new char[stripeSize];
+		_buffer_out_size = stripeSize;
+	}
 	// calculate the total number of blocks by the very last stripe since other stripes should be capacted by number_of_blocks
 	int blockInLastStripe = 0;
 	if(_algorithm == SBC) {
@@ -438,100 +1048,158 @@ std::vector<int> Filer::decompressBlock(std::string fi_name, std::string fo_name
 		int offset = (nStripes - 1) * sizeof(StripeHeader);
 		memcpy(&h, p+offset, sizeof(StripeHeader));
 		/* read the last stripe */
-		int stripeSize = _params.block_size * _params.number_of_blocks;
-		if(!_buffer_in || _buffer_in_size < stripeSize) {
-			if(_buffer_in) {
-				delete [] _buffer_in;
-				std::cout << "WARNING: Filer::decompressBlock, _buffer_in is not valid" << std::endl;
-			}
-			_buffer_in = new char[stripeSize];
-			_buffer_in_size = stripeSize;
-		}
-		if(!_buffer_out || _buffer_out_size < stripeSize) {
-			if(_buffer_out) {
-				delete [] _buffer_out;
-				std::cout << "WARNING: Filer::decompressBlock, _buffer_out is not valid" << std::endl;
-			}
-			_buffer_out = new char[stripeSize];
-			_buffer_out_size = stripeSize;
-		}
-		fseek(_fi, h.offsetOfCompressedData+hdrSize+sizeof(int), SEEK_SET);
-		int cmpSize = fread(_buffer_in, 1, h.compressedStripeSize, _fi);
-		if(cmpSize != h.compressedStripeSize) {
-			std::cout << "ERROR: Filer::decompressBlock, cmpSize != h.compressedStripeSize" << std::endl;
-		}
+		const char* stripeBuffer = readStripe(h, hdrSize);
 		if(h.compressedStripeSize == h.rawStripeSize) {
 			blockInLastStripe = (h.rawStripeSize - 1) / _params.block_size + 1;
 		} else {
-			const char* p = _buffer_in;
+			const char* p = stripeBuffer;
 			int dictSize = 0;
 			memcpy(&dictSize, p, sizeof(int));
 			p += sizeof(int);
-			p += dictSize;
+			p += dictSize > 0 ? dictSize : 0; // a stripe on a shared dictionary stores none
 			int nBlocks = 0;
 			memcpy(&nBlocks, p, sizeof(int));
 			blockInLastStripe = nBlocks;
 		}
 	}
 	int totalBlockNumber = _params.number_of_blocks * (nStripes - 1) + blockInLastStripe;
+	/* a RAC stripe opens with at most this many bytes of dictionary and entry table */
+	int racPrefixBound = 2*sizeof(int) + _params.max_dict + _params.number_of_blocks*sizeof(StripeEntry);
+	int inSize = _algorithm == RAC && racPrefixBound + _params.block_size > stripeSize ? racPrefixBound + _params.block_size : stripeSize;
+	if(!_buffer_in || _buffer_in_size < inSize) {
+		if(_buffer_in) {
+			delete [] _buffer_in;
+		}
+		_buffer_in = new char[inSize];
+		_buffer_in_size = inSize;
+	}
+	_io_bytes = 0;
 
 	int blockNumber = -1;
 	_fo = fopen(fo_name.c_str(), "wb");
 	std::vector<int> randIdxVec;
-	for(int i = 0; i < totalBlockNumber; ++i) {
-		blockNumber = rand() % totalBlockNumber;
-		randIdxVec.push_back(blockNumber);
+	/* SBC/MBC cache decoded stripes; RAC caches the dictionary and entry table of each stripe */
+	StripeCache* cache = NULL;
+	if(_cache_size > 0) {
+		cache = new StripeCache(_cache_size, _cache_policy);
+	}
+	long long int decodedBytes = 0;
+	AccessPattern pattern(_access, totalBlockNumber);
+	long long int nReads = numberOfReads(totalBlockNumber);
+	for(long long int i = 0; i < _access.warmup_reads + nReads; ++i) {
+		bool measured = i >= _access.warmup_reads;
+		if(i == _access.warmup_reads && i > 0) {
+			/* the warm-up leaves the cache and the page cache populated but is not reported */
+			decodedBytes = 0;
+			_io_bytes = 0;
+			if(cache) {
+				cache->resetCounters();
+			}
+			gStats.local().resetDecompression();
+		}
+		blockNumber = pattern.next();
+		if(measured) {
+			randIdxVec.push_back(blockNumber);
+		}
 		int stripeIdx = blockNumber / _params.number_of_blocks;
 		int blockIdx = blockNumber % _params.number_of_blocks;
 		/* read stripe header */
 		StripeHeader h;
 		int offset = stripeIdx * sizeof(StripeHeader);
 		memcpy(&h, p+offset, sizeof(StripeHeader));
-		/* read the stripe [stripeIdx] */
-		int stripeSize = _params.block_size * _params.number_of_blocks;
-		if(!_buffer_in || _buffer_in_size < stripeSize) {
-			if(_buffer_in) {
-				delete [] _buffer_in;
-				std::cout << "WARNING: Filer::decompressBlock, _buffer_in is not valid" << std::endl;
-			}
-			_buffer_in = new char[stripeSize];
-			_buffer_in_size = stripeSize;
-		}
-		if(!_buffer_out || _buffer_out_size < stripeSize) {
-			if(_buffer_out) {
-				delete [] _buffer_out;
-				std::cout << "WARNING: Filer::decompressBlock, _buffer_out is not valid" << std::endl;
-			}
-			_buffer_out = new char[stripeSize];
-			_buffer_out_size = stripeSize;
-		}
-		fseek(_fi, h.offsetOfCompressedData+hdrSize+sizeof(int), SEEK_SET);
-		int cmpSize = fread(_buffer_in, 1, h.compressedStripeSize, _fi);
-		if(cmpSize != h.compressedStripeSize) {
-			std::cout << "ERROR: Filer::decompressBlock, cmpSize != h.compressedStripeSize" << std::endl;
-		}
+		long long int stripePos = h.offsetOfCompressedData+hdrSize+sizeof(int);
 
 		/* decompress block [blockIdx] */
 		char* oPtr = _buffer_out;
 		int decSize = -1;
+		int stripeOffset = blockIdx * _params.block_size;
+		int len = h.rawStripeSize - stripeOffset < _params.block_size ? h.rawStripeSize - stripeOffset : _params.block_size;
 		if(h.compressedStripeSize == h.rawStripeSize) { // Do not forget to hanle the uncompressed stripe, especiall for the case of RAC.
-			int stripeOffset = blockIdx * _params.block_size;
-			memcpy(oPtr, _buffer_in+stripeOffset, _params.block_size);
-			decSize = _params.block_size;
+			/* an uncompressed stripe is read only where the block lies */
+			decSize = len;
+			memcpy(oPtr, readRange(stripePos+stripeOffset, len, _buffer_in), decSize);
+		} else if(_algorithm == RAC) {
+			/* fetch the dictionary and entry table in one read (or take them from the cache), then the block alone */
+			int racHeaderSize = 0;
+			const char* racHeader = cache ? cache->lookup(stripeIdx, &racHeaderSize) : NULL;
+			if(!racHeader) {
+				int prefixSize = h.compressedStripeSize < racPrefixBound ? h.compressedStripeSize : racPrefixBound;
+				racHeader = readRange(stripePos, prefixSize, _buffer_in);
+				racHeaderSize = RACDecompressorBase::stripeHeaderSize(racHeader);
+				if(racHeaderSize > prefixSize) {
+					std::cout << "ERROR: Filer::decompressBlock, dictionary is larger than max_dict" << std::endl;
+					racHeader = NULL;
+				} else if(cache) {
+					char* cPtr = cache->insert(stripeIdx, racHeaderSize);
+					if(cPtr) {
+						memcpy(cPtr, racHeader, racHeaderSize);
+					}
+				}
+			}
+			StripeEntry entry;
+			if(!racHeader || !RACDecompressorBase::getEntry(racHeader, blockIdx, entry)) {
+				std::cout << "ERROR: Filer::decompressBlock, blockIdx is not within range" << std::endl;
+				decSize = 0;
+			} else {
+				const char* blockData = readRange(stripePos+racHeaderSize+entry.offsetOfCompressedData, entry.compressedBlockSize, _buffer_in+racPrefixBound);
+				decSize = ((RACDecompressorBase*) _decompressor)->decompressEntry(racHeader, entry, blockData, oPtr, _params.block_size);
+				decodedBytes += decSize;
+			}
 		} else {
-			decSize = _decompressor->decompressBlock(_buffer_in, cmpSize, oPtr, _buffer_out_size, blockIdx);
+			/* read the stripe [stripeIdx] */
+			int cachedSize = 0;
+			const char* decodedStripe = cache ? cache->lookup(stripeIdx, &cachedSize) : NULL;
+			const char* stripeBuffer = decodedStripe ? NULL : readStripe(h, hdrSize);
+			if(!decodedStripe && cache) {
+				char* cPtr = cache->insert(stripeIdx, h.rawStripeSize);
+				if(cPtr && _decompressor->decompressStripe(stripeBuffer, h.compressedStripeSize, cPtr, h.rawStripeSize) == h.rawStripeSize) {
+					decodedBytes += h.rawStripeSize;
+					decodedStripe = cPtr;
+				} else if(cPtr) {
+					std::cout << "ERROR: Filer::decompressBlock, decompressStripe failed" << std::endl;
+					cache->erase(stripeIdx);
+				}
+			}
+			if(decodedStripe) {
+				decSize = len;
+				memcpy(oPtr, decodedStripe+stripeOffset, decSize);
+			} else {
+				/* MBC decodes at least up to the end of the block, the whole stripe if the codec cannot stop early */
+				int decodedSize = 0;
+				decSize = _decompressor->decompressBlock(stripeBuffer, h.compressedStripeSize, oPtr, _buffer_out_size, blockIdx, &decodedSize);
+				decodedBytes += decodedSize;
+				if(decSize != len) {
+					std::cout << "ERROR: Filer::decompressBlock, decompressBlock failed" << std::endl;
+					decSize = 0;
+				}
+			}
+		}
+		if(measured) {
+			fwrite(oPtr, 1, decSize, _fo);
+			dstSize += decSize;
 		}
-		fwrite(oPtr, 1, decSize, _fo);
-		dstSize += decSize;
 	}
 
 	fseek(_fo, 0, SEEK_END);
 	gStats.total_decompressed_size = ftell(_fo);
+	gStats.total_decoded_bytes = decodedBytes;
+	gStats.total_served_bytes = dstSize;
+	gStats.total_io_bytes = _io_bytes;
+	gStats.cache_hits = cache ? cache->getHits() : 0;
+	gStats.cache_misses = cache ? cache->getMisses() : 0;
 
 	/* clean up */
-	fclose(_fi);
+	if(cache) {
+		delete cache;
+	}
+	if(_io_engine == MmapEngine) {
+		unmapFile();
+	} else {
+		fclose(_fi);
+		_fi = NULL;
+		delete [] hdrBuffer;
+	}
 	fclose(_fo);
-	_fi = NULL;
 	_fo = NULL;
 	delete [] _buffer_in;
 	delete [] _buffer_out;
@@ -540,4 +1208,305 @@ std::vector<int> Filer::decompressBlock(std::string fi_name, std::string fo_name
 	return randIdxVec;
 }
 
+/* Return a pointer to the compressed stripe described by h. The stdio and pread engines read it into _buffer_in,
+ * the mmap engine addresses it directly in the mapping without any copy.
+ */
+const char* Filer::readStripe(const StripeHeader& h, int hdrSize) {
+	long long int pos = h.offsetOfCompressedData+hdrSize+sizeof(int);
+	int stripeSize = _params.block_size * _params.number_of_blocks;
+	if(_io_engine != MmapEngine && (!_buffer_in || _buffer_in_size < stripeSize)) {
+		if(_buffer_in) {
+			delete [] _buffer_in;
+			std::cout << "WARNING: Filer::decompressBlock, _buffer_in is not valid" << std::endl;
+		}
+		_buffer_in = new char[stripeSize];
+		_buffer_in_size = stripeSize;
+	}
+	return readRange(pos, h.compressedStripeSize, _buffer_in);
+}
+
+const char* Filer::readRange(long long int pos, int size, char* buffer) {
+	_io_bytes += size;
+	if(_io_engine == MmapEngine) {
+		return _map_base + pos;
+	}
+	int rsize = -1;
+	if(_io_engine == PreadEngine) {
+		rsize = pread(fileno(_fi), buffer, size, pos);
+	} else {
+		fseek(_fi, pos, SEEK_SET);
+		rsize = fread(buffer, 1, size, _fi);
+	}
+	if(rsize != size) {
+		std::cout << "ERROR: Filer::readRange, rsize != size" << std::endl;
+	}
+	return buffer;
+}
+
+bool Filer::mapFile(std::string fi_name) {
+	int fd = open(fi_name.c_str(), O_RDONLY);
+	if(fd < 0) {
+		std::cout << "ERROR: Filer::mapFile, cannot open " << fi_name << std::endl;
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	_file_in_size = st.st_size;
+	void* base = mmap(NULL, _file_in_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // the mapping keeps its own reference to the file
+	if(base == MAP_FAILED) {
+		std::cout << "ERROR: Filer::mapFile, mmap failed" << std::endl;
+		return false;
+	}
+	madvise(base, _file_in_size, MADV_RANDOM);
+	_map_base = (const char*) base;
+	return true;
+}
+
+void Filer::unmapFile() {
+	if(_map_base) {
+		munmap((void*) _map_base, _file_in_size);
+		_map_base = NULL;
+	}
+}
+
+/* Run _number_of_threads reader threads against one CompressedFileReader. Together they issue numberOfReads
+ * block reads drawn from _access, after the warm-up reads have been issued from the calling thread. Thread t
+ * draws its own sequence, seeded with _access.seed + t + 1. Returns the number of bytes served.
+ */
+long long int Filer::concurrentDecompressBlock(std::string fi_name) {
+	CompressedFileReader reader;
+	if(!reader.open(fi_name, _io_engine == MmapEngine ? MmapEngine : PreadEngine)) {
+		return -1;
+	}
+	_algorithm = reader.getAlgorithm();
+	_params = reader.getParams();
+	gStats.total_compressed_size = reader.getFileSize();
+	long long int nReads = numberOfReads(reader.getNumberOfBlocks());
+	warmUp(&reader);
+	std::vector<ReadThreadStats> threadStats(_number_of_threads);
+	std::vector<std::thread> workers;
+	std::chrono::time_point<std::chrono::steady_clock> t_start = std::chrono::steady_clock::now();
+	for(int t = 0; t < _number_of_threads; ++t) {
+		threadStats[t].thread = t;
+		long long int reads = nReads / _number_of_threads + (t < nReads % _number_of_threads ? 1 : 0);
+		workers.push_back(std::thread(&Filer::readWorker, this, &reader, reads, &threadStats[t]));
+	}
+	for(int t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+	std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+	gStats.read_wall_timer = t_end - t_start;
+	gStats.total_read_blocks = 0;
+	gStats.total_read_bytes = 0;
+	for(int t = 0; t < threadStats.size(); ++t) {
+		gStats.total_read_blocks += threadStats[t].reads;
+		gStats.total_read_bytes += threadStats[t].bytes;
+	}
+	gStats.total_decompressed_size = gStats.total_read_bytes;
+	gStats.read_threads = threadStats;
+	return gStats.total_read_bytes;
+}
+
+void Filer::readWorker(CompressedFileReader* reader, long long int nReads, ReadThreadStats* stats) {
+	AccessParameter access = _access;
+	access.seed = _access.seed + stats->thread + 1;
+	AccessPattern pattern(access, reader->getNumberOfBlocks());
+	char* blkBuffer = new char[_params.block_size];
+	stats->reads = 0;
+	stats->bytes = 0;
+	stats->latency_sum = std::chrono::duration<double>(0);
+	stats->latency_max = std::chrono::duration<double>(0);
+	for(long long int i = 0; i < nReads; ++i) {
+		long long int blockNumber = pattern.next();
+		std::chrono::time_point<std::chrono::steady_clock> t_start = std::chrono::steady_clock::now();
+		int decSize = reader->readBlock(blockNumber, blkBuffer);
+		std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+		std::chrono::duration<double> latency = t_end - t_start;
+		if(decSize < 0) {
+			std::cout << "ERROR: Filer::readWorker, readBlock failed" << std::endl;
+			continue;
+		}
+		stats->reads++;
+		stats->bytes += decSize;
+		stats->latency_sum += latency;
+		if(latency > stats->latency_max) {
+			stats->latency_max = latency;
+		}
+	}
+	delete [] blkBuffer;
+}
+
+/* Open-loop random read. Requests arrive at _target_qps, spaced evenly or exponentially, whether or not the
+ * earlier ones have finished, and are served by _number_of_threads reader threads. Each response time is
+ * measured from the request's scheduled arrival rather than from when a thread picked it up, so queueing
+ * behind a slow read is counted instead of hidden (coordinated omission). Returns the number of bytes served.
+ */
+long long int Filer::openLoopDecompressBlock(std::string fi_name) {
+	if(_target_qps <= 0) {
+		std::cout << "ERROR: Filer::openLoopDecompressBlock, target QPS is not set" << std::endl;
+		return -1;
+	}
+	CompressedFileReader reader;
+	if(!reader.open(fi_name, _io_engine == MmapEngine ? MmapEngine : PreadEngine)) {
+		return -1;
+	}
+	_algorithm = reader.getAlgorithm();
+	_params = reader.getParams();
+	gStats.total_compressed_size = reader.getFileSize();
+	long long int nReads = numberOfReads(reader.getNumberOfBlocks());
+	warmUp(&reader);
+	AccessParameter access = _access;
+	access.seed = _access.seed + 1;
+	AccessPattern pattern(access, reader.getNumberOfBlocks());
+	std::mt19937_64 generator(_access.seed);
+	std::exponential_distribution<double> gapDistribution(_target_qps);
+	std::vector<long long int> blocks(nReads);
+	std::vector<double> arrivals(nReads);
+	double arrival = 0;
+	for(long long int i = 0; i < nReads; ++i) {
+		blocks[i] = pattern.next();
+		arrivals[i] = arrival;
+		arrival += _arrival == PoissonArrival ? gapDistribution(generator) : 1.0 / _target_qps;
+	}
+	std::vector<LatencyHistogram> threadLatencies(_number_of_threads);
+	std::vector<long long int> threadReads(_number_of_threads, 0);
+	std::vector<long long int> threadBytes(_number_of_threads, 0);
+	std::atomic<long long int> next(0);
+	std::vector<std::thread> workers;
+	std::chrono::time_point<std::chrono::steady_clock> t_start = std::chrono::steady_clock::now();
+	for(int t = 0; t < _number_of_threads; ++t) {
+		workers.push_back(std::thread(&Filer::openLoopWorker, this, &reader, &blocks, &arrivals, t_start, &next, &threadLatencies[t], &threadReads[t], &threadBytes[t]));
+	}
+	for(int t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+	std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+	gStats.read_wall_timer = t_end - t_start;
+	gStats.total_read_blocks = 0;
+	gStats.total_read_bytes = 0;
+	gStats.read_latency_histogram.reset();
+	for(int t = 0; t < threadBytes.size(); ++t) {
+		gStats.total_read_blocks += threadReads[t];
+		gStats.total_read_bytes += threadBytes[t];
+		gStats.read_latency_histogram.merge(threadLatencies[t]);
+	}
+	gStats.total_decompressed_size = gStats.total_read_bytes;
+	return gStats.total_read_bytes;
+}
+
+void Filer::warmUp(CompressedFileReader* reader) {
+	if(_access.warmup_reads == 0) {
+		return;
+	}
+	AccessPattern pattern(_access, reader->getNumberOfBlocks());
+	char* blkBuffer = new char[_params.block_size];
+	for(long long int i = 0; i < _access.warmup_reads; ++i) {
+		if(reader->readBlock(pattern.next(), blkBuffer) < 0) {
+			std::cout << "ERROR: Filer::warmUp, readBlock failed" << std::endl;
+		}
+	}
+	delete [] blkBuffer;
+	gStats.local().resetDecompression();
+}
+
+void Filer::openLoopWorker(CompressedFileReader* reader, const std::vector<long long int>* blocks, const std::vector<double>* arrivals, std::chrono::time_point<std::chrono::steady_clock> t_start, std::atomic<long long int>* next, LatencyHistogram* latencies, long long int* reads, long long int* bytes) {
+	char* blkBuffer = new char[_params.block_size];
+	long long int i;
+	while((i = next->fetch_add(1)) < (long long int) blocks->size()) {
+		std::chrono::time_point<std::chrono::steady_clock> intended = t_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((*arrivals)[i]));
+		std::this_thread::sleep_until(intended);
+		int decSize = reader->readBlock((*blocks)[i], blkBuffer);
+		std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+		latencies->record(std::chrono::duration<double>(t_end - intended));
+		if(decSize < 0) {
+			std::cout << "ERROR: Filer::openLoopWorker, readBlock failed" << std::endl;
+			continue;
+		}
+		(*reads)++;
+		*bytes += decSize;
+	}
+	delete [] blkBuffer;
+}
+
+/* Replay the trace set by setTrace against a compressed file. Every record becomes one readRange of its
+ * byte range, served by _number_of_threads reader threads. FastReplay issues the
+ * operations back to back and measures each from when a thread starts it. TimedReplay issues each one at its
+ * recorded timestamp, relative to the first record, and measures it from that time as the open-loop workload
+ * does. Records of length 0 read nothing and are skipped. Returns the number of bytes served, with ranges
+ * clamped at the end of the file and failed reads left out, or -1 on error.
+ */
+long long int Filer::replayTrace(std::string fi_name) {
+	CompressedFileReader reader;
+	if(!reader.open(fi_name, _io_engine == MmapEngine ? MmapEngine : PreadEngine)) {
+		return -1;
+	}
+	_algorithm = reader.getAlgorithm();
+	_params = reader.getParams();
+	gStats.total_compressed_size = reader.getFileSize();
+	std::vector<TraceRecord> records;
+	if(!loadTrace(_trace_name, _trace_unit, _params.block_size, records)) {
+		return -1;
+	}
+	std::vector<LatencyHistogram> threadLatencies(_number_of_threads);
+	std::vector<long long int> threadBlocks(_number_of_threads, 0);
+	std::vector<long long int> threadBytes(_number_of_threads, 0);
+	std::atomic<long long int> next(0);
+	std::vector<std::thread> workers;
+	std::chrono::time_point<std::chrono::steady_clock> t_start = std::chrono::steady_clock::now();
+	for(int t = 0; t < _number_of_threads; ++t) {
+		workers.push_back(std::thread(&Filer::replayWorker, this, &reader, &records, t_start, &next, &threadLatencies[t], &threadBlocks[t], &threadBytes[t]));
+	}
+	for(int t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+	std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+	gStats.read_wall_timer = t_end - t_start;
+	gStats.total_read_blocks = 0;
+	gStats.total_read_bytes = 0;
+	gStats.read_latency_histogram.reset();
+	for(int t = 0; t < threadBytes.size(); ++t) {
+		gStats.total_read_blocks += threadBlocks[t];
+		gStats.total_read_bytes += threadBytes[t];
+		gStats.read_latency_histogram.merge(threadLatencies[t]);
+	}
+	gStats.total_decompressed_size = gStats.total_read_bytes;
+	return gStats.total_read_bytes;
+}
+
+void Filer::replayWorker(CompressedFileReader* reader, const std::vector<TraceRecord>* records, std::chrono::time_point<std::chrono::steady_clock> t_start, std::atomic<long long int>* next, LatencyHistogram* latencies, long long int* blocks, long long int* bytes) {
+	long long int rawSize = reader->getRawSize();
+	double firstTimestamp = records->empty() ? 0 : (*records)[0].timestamp;
+	std::vector<char> rangeBuffer;
+	long long int i;
+	while((i = next->fetch_add(1)) < (long long int) records->size()) {
+		const TraceRecord& r = (*records)[i];
+		std::chrono::time_point<std::chrono::steady_clock> begin = std::chrono::steady_clock::now();
+		if(_replay_mode == TimedReplay) {
+			begin = t_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(r.timestamp - firstTimestamp));
+			std::this_thread::sleep_until(begin);
+		}
+		if(r.length == 0) {
+			continue;
+		}
+		long long int end = r.offset + r.length < rawSize ? r.offset + r.length : rawSize;
+		if(r.offset >= end) {
+			std::cout << "ERROR: Filer::replayWorker, record " << i << " is outside the file" << std::endl;
+			continue;
+		}
+		if(rangeBuffer.size() < end - r.offset) {
+			rangeBuffer.resize(end - r.offset);
+		}
+		long long int rsize = reader->readRange(r.offset, end - r.offset, rangeBuffer.data());
+		std::chrono::time_point<std::chrono::steady_clock> t_end = std::chrono::steady_clock::now();
+		latencies->record(std::chrono::duration<double>(t_end - begin));
+		if(rsize != end - r.offset) {
+			std::cout << "ERROR: Filer::replayWorker, readRange failed" << std::endl;
+			continue;
+		}
+		*blocks += (end - 1) / _params.block_size - r.offset / _params.block_size + 1;
+		*bytes += rsize;
+	}
+}
+
 #endif
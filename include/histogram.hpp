@@ -0,0 +1,144 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/* HDR-style latency histogram over nanoseconds. Values below HISTOGRAM_SUB_BUCKETS are counted exactly. Each
+ * power of two above that is split into HISTOGRAM_SUB_BUCKETS linear sub-buckets, so every reported value is
+ * within 1/HISTOGRAM_SUB_BUCKETS (about 3%) of what was recorded. The memory is fixed no matter how many values are recorded.
+ */
+class LatencyHistogram {
+private:
+	std::vector<long long int> _counts;
+	long long int _total_count;
+	long long int _min;
+	long long int _max;
+	double _sum;
+	static int bucketIndex(long long int value);
+	static long long int bucketHighestValue(int index);
+public:
+	LatencyHistogram();
+	void reset();
+	void record(long long int nanoseconds);
+	void record(std::chrono::duration<double> latency);
+	void merge(const LatencyHistogram& other);
+	long long int count() const;
+	long long int min() const;
+	long long int max() const;
+	double mean() const;
+	// smallest recorded value (in nanoseconds, up to bucket precision) that p percent of the values do not exceed
+	long long int percentile(double p) const;
+};
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	_counts.assign(HISTOGRAM_BUCKETS, 0);
+	_total_count = 0;
+	_min = 0;
+	_max = 0;
+	_sum = 0;
+}
+
+int LatencyHistogram::bucketIndex(long long int value) {
+	if(value < HISTOGRAM_SUB_BUCKETS) {
+		return (int) value;
+	}
+	int msb = 63 - __builtin_clzll((unsigned long long) value);
+	int exponent = msb - HISTOGRAM_SUB_BUCKET_BITS;
+	int sub = (int) (value >> exponent) - HISTOGRAM_SUB_BUCKETS;
+	return (exponent + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+long long int LatencyHistogram::bucketHighestValue(int index) {
+	if(index < HISTOGRAM_SUB_BUCKETS) {
+		return index;
+	}
+	int exponent = index / HISTOGRAM_SUB_BUCKETS - 1;
+	long long int sub = index % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+	return ((sub + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::record(long long int nanoseconds) {
+	if(nanoseconds < 0) {
+		nanoseconds = 0;
+	}
+	_counts[bucketIndex(nanoseconds)]++;
+	if(_total_count == 0 || nanoseconds < _min) {
+		_min = nanoseconds;
+	}
+	if(nanoseconds > _max) {
+		_max = nanoseconds;
+	}
+	_total_count++;
+	_sum += nanoseconds;
+}
+
+void LatencyHistogram::record(std::chrono::duration<double> latency) {
+	record((long long int) (latency.count() * 1e9));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+	if(other._total_count == 0) {
+		return;
+	}
+	for(int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		_counts[i] += other._counts[i];
+	}
+	if(_total_count == 0 || other._min < _min) {
+		_min = other._min;
+	}
+	if(other._max > _max) {
+		_max = other._max;
+	}
+	_total_count += other._total_count;
+	_sum += other._sum;
+}
+
+long long int LatencyHistogram::count() const {
+	return _total_count;
+}
+
+long long int LatencyHistogram::min() const {
+	return _min;
+}
+
+long long int LatencyHistogram::max() const {
+	return _max;
+}
+
+double LatencyHistogram::mean() const {
+	return _total_count > 0 ? _sum / _total_count : 0;
+}
+
+long long int LatencyHistogram::percentile(double p) const {
+	if(_total_count == 0) {
+		return 0;
+	}
+	long long int rank = (long long int) std::ceil(p / 100 * _total_count);
+	if(rank < 1) {
+		rank = 1;
+	}
+	if(rank > _total_count) {
+		rank = _total_count;
+	}
+	long long int seen = 0;
+	for(int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		seen += _counts[i];
+		if(seen >= rank) {
+			long long int value = bucketHighestValue(i);
+			return value < _max ? value : _max;
+		}
+	}
+	return _max;
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef KMERDICT_H
+#define KMERDICT_H
+
+#include <stdint.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+/* Build with -DMBC_ENABLE_SIMD=0 to hash d-mers with the scalar loop only. Otherwise the AVX2 loop is compiled in
+ * (GCC and Clang on x86-64) and taken whenever the CPU running the benchmark has AVX2; both give the same hashes.
+ */
+#ifndef MBC_ENABLE_SIMD
+#define MBC_ENABLE_SIMD 1
+#endif
+
+#if MBC_ENABLE_SIMD && defined(__x86_64__) && defined(__GNUC__)
+#define KMERDICT_AVX2 1
+#include <immintrin.h>
+#else
+#define KMERDICT_AVX2 0
+#endif
+
+#define KMERDICT_MAX_KMER 8 // a d-mer is hashed from one 8-byte window
+#define KMERDICT_MIN_TABLE_LOG 10
+#define KMERDICT_MAX_TABLE_LOG 20
+#define KMERDICT_SEGMENTS_PER_EPOCH 4
+#define KMERDICT_DEFAULT_SEGMENT 64 // k when the caller leaves it to the trainer (COVER searches k instead)
+#define KMERDICT_DEFAULT_KMER 8
+#define KMERDICT_NO_HASH 0xFFFFFFFFu // d-mers that cross the end of a sample
+
+/* In-tree version of the COVER algorithm for RAC stripes: the samples are a few hundred blocks of a few KB, so
+ * instead of sorting suffixes it hashes the d-mer starting at every position, counts in how many samples each hash
+ * occurs, and greedily picks the k-byte segments whose distinct d-mers are the most frequent. Like COVER, the
+ * samples are split into epochs and the segments are picked round robin over the epochs, and the d-mers of a
+ * picked segment are not counted again. The best segments go to the end of the dictionary, closest to the data.
+ * The frequency table has one slot per position of the samples, rounded up to a power of two, and keeps the
+ * count, the last sample counted and the count inside the current segment of a hash side by side.
+ */
+class KmerDictionaryBuilder {
+private:
+	struct Slot {
+		uint16_t freq; // samples the d-mer occurs in, saturated
+		uint16_t sample; // last sample counted, plus one; wraps after 65535 samples
+		uint16_t active; // occurrences inside the segment being scored
+	};
+	int _k;
+	int _d;
+	int _table_log;
+	uint32_t _lo_mask;
+	uint32_t _hi_mask;
+	std::vector<uint32_t> _hashes;
+	std::vector<Slot> _table;
+	long long int _score;
+	void countSamples(const std::vector<size_t>& sampleSizes);
+	int selectSegment(int begin, int end, long long int& bestScore);
+	void addKmer(int pos);
+	void removeKmer(int pos);
+public:
+	KmerDictionaryBuilder(int k, int d);
+	// whether hash() takes the AVX2 loop on this CPU
+	static bool vectorSupported();
+	// table index of the d-mer at every position of src; reads at most srcSize bytes, ends with scalar hashes
+	void hash(const char* src, int srcSize, uint32_t* hashes, int tableLog) const;
+	void hashScalar(const char* src, int srcSize, uint32_t* hashes, int tableLog) const;
+#if KMERDICT_AVX2
+	void hashVector(const char* src, int srcSize, uint32_t* hashes, int tableLog) const;
+#endif
+	// writes the dictionary content to the front of dictBuffer and returns its size, 0 if the samples are too small
+	int build(char* dictBuffer, int dictCapacity, const char* samples, const std::vector<size_t>& sampleSizes);
+};
+
+KmerDictionaryBuilder::KmerDictionaryBuilder(int k, int d) {
+	if(d <= 0) {
+		d = KMERDICT_DEFAULT_KMER;
+	} else if(d > KMERDICT_MAX_KMER) {
+		std::cout << "WARNING: KmerDictionaryBuilder, d-mers longer than " << KMERDICT_MAX_KMER << " bytes are not supported, use " << KMERDICT_MAX_KMER << " instead" << std::endl;
+		d = KMERDICT_MAX_KMER;
+	}
+	if(k <= 0) {
+		k = KMERDICT_DEFAULT_SEGMENT;
+	}
+	if(k < d) {
+		std::cout << "WARNING: KmerDictionaryBuilder, segment size " << k << " is below the d-mer size, use " << d << " instead" << std::endl;
+		k = d;
+	}
+	_k = k;
+	_d = d;
+	_table_log = KMERDICT_MIN_TABLE_LOG;
+	/* the low four bytes of the window and the rest, each hashed with one 32-bit multiply */
+	_lo_mask = d >= 4 ? 0xFFFFFFFFu : (1u << (8*d)) - 1;
+	_hi_mask = d > 4 ? (uint32_t) ((1ull << (8*(d-4))) - 1) : 0;
+	_score = 0;
+}
+
+bool KmerDictionaryBuilder::vectorSupported() {
+#if KMERDICT_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+void KmerDictionaryBuilder::hash(const char* src, int srcSize, uint32_t* hashes, int tableLog) const {
+#if KMERDICT_AVX2
+	static const bool vector = vectorSupported();
+	if(vector) {
+		hashVector(src, srcSize, hashes, tableLog);
+		return;
+	}
+#endif
+	hashScalar(src, srcSize, hashes, tableLog);
+}
+
+void KmerDictionaryBuilder::hashScalar(const char* src, int srcSize, uint32_t* hashes, int tableLog) const {
+	/* the 8 bytes from position i, first byte lowest; past the end of src it reads as zeros */
+	uint64_t window = 0;
+	for(int j = 0; j < 8 && j < srcSize; ++j) {
+		window |= (uint64_t) (unsigned char) src[j] << (8*j);
+	}
+	for(int i = 0; i < srcSize; ++i) {
+		uint32_t lo = (uint32_t) window & _lo_mask;
+		uint32_t hi = (uint32_t) (window >> 32) & _hi_mask;
+		hashes[i] = (lo * 0x9E3779B1u + hi * 0x85EBCA77u) >> (32 - tableLog);
+		window >>= 8;
+		if(i + 8 < srcSize) {
+			window |= (uint64_t) (unsigned char) src[i+8] << 56;
+		}
+	}
+}
+
+#if KMERDICT_AVX2
+__attribute__((target("avx2")))
+void KmerDictionaryBuilder::hashVector(const char* src, int srcSize, uint32_t* hashes, int tableLog) const {
+	/* one 16-byte load holds the windows of 8 positions: the shuffles gather the low and high four bytes of each */
+	const __m256i loBytes = _mm256_setr_epi8(0,1,2,3, 1,2,3,4, 2,3,4,5, 3,4,5,6, 4,5,6,7, 5,6,7,8, 6,7,8,9, 7,8,9,10);
+	const __m256i hiBytes = _mm256_setr_epi8(4,5,6,7, 5,6,7,8, 6,7,8,9, 7,8,9,10, 8,9,10,11, 9,10,11,12, 10,11,12,13, 11,12,13,14);
+	const __m256i loMask = _mm256_set1_epi32((int) _lo_mask);
+	const __m256i hiMask = _mm256_set1_epi32((int) _hi_mask);
+	const __m256i loPrime = _mm256_set1_epi32((int) 0x9E3779B1u);
+	const __m256i hiPrime = _mm256_set1_epi32((int) 0x85EBCA77u);
+	const __m128i shift = _mm_cvtsi32_si128(32 - tableLog);
+	int i = 0;
+	for(; i + 16 <= srcSize; i += 8) {
+		__m256i bytes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) (src + i)));
+		__m256i lo = _mm256_and_si256(_mm256_shuffle_epi8(bytes, loBytes), loMask);
+		__m256i hi = _mm256_and_si256(_mm256_shuffle_epi8(bytes, hiBytes), hiMask);
+		__m256i h = _mm256_add_epi32(_mm256_mullo_epi32(lo, loPrime), _mm256_mullo_epi32(hi, hiPrime));
+		_mm256_storeu_si256((__m256i*) (hashes + i), _mm256_srl_epi32(h, shift));
+	}
+	hashScalar(src + i, srcSize - i, hashes + i, tableLog);
+}
+#endif
+
+void KmerDictionaryBuilder::countSamples(const std::vector<size_t>& sampleSizes) {
+	int pos = 0;
+	for(int s = 0; s < sampleSizes.size(); ++s) {
+		int end = pos + (int) sampleSizes[s];
+		uint16_t stamp = (uint16_t) (s + 1);
+		for(; pos + _d <= end; ++pos) {
+			Slot& slot = _table[_hashes[pos]];
+			if(slot.sample != stamp) {
+				slot.sample = stamp;
+				if(slot.freq < 0xFFFF) {
+					slot.freq++;
+				}
+			}
+		}
+		for(; pos < end; ++pos) {
+			_hashes[pos] = KMERDICT_NO_HASH;
+		}
+	}
+}
+
+void KmerDictionaryBuilder::addKmer(int pos) {
+	uint32_t h = _hashes[pos];
+	if(h != KMERDICT_NO_HASH && _table[h].active++ == 0) {
+		_score += _table[h].freq;
+	}
+}
+
+void KmerDictionaryBuilder::removeKmer(int pos) {
+	uint32_t h = _hashes[pos];
+	if(h != KMERDICT_NO_HASH && --_table[h].active == 0) {
+		_score -= _table[h].freq;
+	}
+}
+
+int KmerDictionaryBuilder::selectSegment(int begin, int end, long long int& bestScore) {
+	/* slide a window of the k-d+1 d-mers of a segment over the epoch, scoring its distinct d-mers */
+	int kmers = _k - _d + 1;
+	int last = end - _k;
+	int bestPos = -1;
+	bestScore = 0;
+	if(last < begin) {
+		return bestPos;
+	}
+	_score = 0;
+	for(int pos = begin; pos < begin + kmers - 1; ++pos) {
+		addKmer(pos);
+	}
+	for(int pos = begin; pos <= last; ++pos) {
+		addKmer(pos + kmers - 1);
+		if(_score > bestScore) {
+			bestScore = _score;
+			bestPos = pos;
+		}
+		removeKmer(pos);
+	}
+	for(int pos = last + 1; pos < last + kmers; ++pos) {
+		removeKmer(pos);
+	}
+	return bestPos;
+}
+
+int KmerDictionaryBuilder::build(char* dictBuffer, int dictCapacity, const char* samples, const std::vector<size_t>& sampleSizes) {
+	int total = 0;
+	for(int s = 0; s < sampleSizes.size(); ++s) {
+		total += (int) sampleSizes[s];
+	}
+	if(total < _k || dictCapacity < _k) {
+		return 0;
+	}
+	_table_log = KMERDICT_MIN_TABLE_LOG;
+	while(_table_log < KMERDICT_MAX_TABLE_LOG && (1 << _table_log) < total) {
+		_table_log++;
+	}
+	_hashes.resize(total);
+	hash(samples, total, _hashes.data(), _table_log);
+	Slot empty = {0, 0, 0};
+	_table.assign(1 << _table_log, empty);
+	countSamples(sampleSizes);
+
+	int nSegments = dictCapacity / _k;
+	int nEpochs = nSegments / KMERDICT_SEGMENTS_PER_EPOCH;
+	nEpochs = nEpochs < 1 ? 1 : nEpochs > total / _k ? total / _k : nEpochs;
+	int epochSize = total / nEpochs;
+	int tail = dictCapacity;
+	/* stop after a full round over the epochs finds nothing worth adding */
+	int idleEpochs = 0;
+	for(int epoch = 0; tail >= _d && idleEpochs < nEpochs; epoch = (epoch + 1) % nEpochs) {
+		int begin = epoch * epochSize;
+		int end = epoch == nEpochs - 1 ? total : begin + epochSize;
+		long long int score = 0;
+		int pos = selectSegment(begin, end, score);
+		if(pos < 0) {
+			idleEpochs++;
+			continue;
+		}
+		idleEpochs = 0;
+		int len = tail < _k ? tail : _k;
+		memcpy(dictBuffer + tail - len, samples + pos, len);
+		tail -= len;
+		for(int kmer = pos; kmer + _d <= pos + _k; ++kmer) {
+			if(_hashes[kmer] != KMERDICT_NO_HASH) {
+				_table[_hashes[kmer]].freq = 0;
+			}
+		}
+	}
+	int dictSize = dictCapacity - tail;
+	memmove(dictBuffer, dictBuffer + tail, dictSize);
+	return dictSize;
+}
+
+#endif
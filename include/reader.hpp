@@ -0,0 +1,533 @@
+#ifndef READER_H
+#define READER_H
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "decompressor.hpp"
+
+/* CompressedFileReader opens a file produced by Filer::compressFile once, keeps the parsed
+ * StripeHeader table in memory and serves block reads from any number of threads at once.
+ * Stripes are fetched with pread (or addressed in a read-only mapping) into per-thread scratch
+ * buffers, so no state is shared between concurrent readBlock calls.
+ */
+class CompressedFileReader {
+private:
+	int _fd;
+	IOEngine _io_engine;
+	const char* _map_base;
+	long long int _file_size;
+	long long int _data_offset;
+	CompressionAlgorithm _algorithm;
+	CompressionParameter _params;
+	std::vector<StripeHeader> _stripes;
+	long long int _number_of_blocks;
+	long long int _raw_size;
+	Decompressor* _decompressor;
+	bool readAt(char* buffer, int size, long long int pos);
+	const char* fetchStripe(const StripeHeader& h, char* buffer);
+	// like readAt, but the mmap engine returns a pointer into the mapping instead of copying
+	const char* fetchRange(long long int pos, int size, char* buffer);
+public:
+	CompressedFileReader();
+	virtual ~CompressedFileReader();
+	bool open(std::string fi_name, IOEngine engine = PreadEngine);
+	void close();
+	CompressionAlgorithm getAlgorithm();
+	CompressionParameter getParams();
+	long long int getFileSize();
+	int getNumberOfStripes();
+	long long int getNumberOfBlocks();
+	// size of the uncompressed file
+	long long int getRawSize();
+	// return the size of block globalBlockIdx written to dst, which must hold at least block_size bytes; -1 on error
+	int readBlock(long long int globalBlockIdx, char* dst);
+	/* Read a batch of blocks. Request i is written to dst + i * block_size and its size (-1 on error) to sizes[i].
+	 * Requests are grouped by stripe, so every stripe involved is fetched once and decoded once (MBC), or
+	 * has its dictionary and entry table parsed once (RAC). Returns the number of blocks read.
+	 */
+	int readBlocks(const std::vector<long long int>& globalBlockIdxs, char* dst, std::vector<int>& sizes);
+	/* Read length bytes of the uncompressed file starting at offset into dst, clipped at the end of the file.
+	 * Only the blocks overlapping the range are decoded (MBC decodes each stripe up to the last of them), and
+	 * blocks the range covers entirely are decoded straight into dst. Returns the number of bytes read, or -1 on error.
+	 */
+	long long int readRange(long long int offset, long long int length, char* dst);
+};
+
+// scratch buffers owned by each reading thread
+struct ReaderScratch {
+	char* buffer_in;
+	char* buffer_out;
+	int buffer_in_size;
+	int buffer_out_size;
+
+	ReaderScratch() {
+		buffer_in = NULL;
+		buffer_out = NULL;
+		buffer_in_size = 0;
+		buffer_out_size = 0;
+	}
+
+	~ReaderScratch() {
+		delete [] buffer_in;
+		delete [] buffer_out;
+	}
+
+	void reserve(int inSize, int outSize) {
+		if(buffer_in_size < inSize) {
+			delete [] buffer_in;
+			buffer_in = new char[inSize];
+			buffer_in_size = inSize;
+		}
+		if(buffer_out_size < outSize) {
+			delete [] buffer_out;
+			buffer_out = new char[outSize];
+			buffer_out_size = outSize;
+		}
+	}
+};
+
+static ReaderScratch& readerScratch() {
+	static thread_local ReaderScratch scratch;
+	return scratch;
+}
+
+CompressedFileReader::CompressedFileReader() {
+	_fd = -1;
+	_io_engine = PreadEngine;
+	_map_base = NULL;
+	_file_size = 0;
+	_data_offset = 0;
+	_number_of_blocks = 0;
+	_raw_size = 0;
+	_decompressor = NULL;
+}
+
+CompressedFileReader::~CompressedFileReader() {
+	close();
+}
+
+bool CompressedFileReader::open(std::string fi_name, IOEngine engine) {
+	close();
+	_io_engine = engine == MmapEngine ? MmapEngine : PreadEngine;
+	_fd = ::open(fi_name.c_str(), O_RDONLY);
+	if(_fd < 0) {
+		std::cout << "ERROR: CompressedFileReader::open, cannot open " << fi_name << std::endl;
+		return false;
+	}
+	struct stat st;
+	fstat(_fd, &st);
+	_file_size = st.st_size;
+	if(_io_engine == MmapEngine) {
+		void* base = mmap(NULL, _file_size, PROT_READ, MAP_SHARED, _fd, 0);
+		if(base == MAP_FAILED) {
+			std::cout << "ERROR: CompressedFileReader::open, mmap failed" << std::endl;
+			close();
+			return false;
+		}
+		madvise(base, _file_size, MADV_RANDOM);
+		_map_base = (const char*) base;
+	}
+
+	/* parse the header once */
+	int hdrSize = -1;
+	readAt((char*) &hdrSize, sizeof(int), 0);
+	if(hdrSize < 0 || hdrSize + sizeof(int) > _file_size) {
+		std::cout << "ERROR: CompressedFileReader::open, hdrSize is invalid" << std::endl;
+		close();
+		return false;
+	}
+	_data_offset = hdrSize + sizeof(int);
+	char* hdrBuffer = new char[hdrSize];
+	readAt(hdrBuffer, hdrSize, sizeof(int));
+	const char* p = hdrBuffer + 8;
+	memcpy(&_params, p, sizeof(CompressionParameter));
+	if(hdrBuffer[0] == 'S' && hdrBuffer[1] == 'B' && hdrBuffer[2] == 'C') {
+		_algorithm = SBC;
+		_decompressor = Decompressor::create(SBC, _params);
+	} else if(hdrBuffer[0] == 'M' && hdrBuffer[1] == 'B' && hdrBuffer[2] == 'C') {
+		_algorithm = MBC;
+		_decompressor = Decompressor::create(MBC, _params);
+	} else if(hdrBuffer[0] == 'R' && hdrBuffer[1] == 'A' && hdrBuffer[2] == 'C') {
+		_algorithm = RAC;
+		_decompressor = Decompressor::create(RAC, _params);
+	}
+	p += sizeof(CompressionParameter);
+	int nStripes = -1;
+	memcpy(&nStripes, p, sizeof(int));
+	p += sizeof(int);
+	if(nStripes <= 0 || 8 + sizeof(CompressionParameter) + sizeof(int) + (long long int) nStripes * sizeof(StripeHeader) > hdrSize) {
+		std::cout << "ERROR: CompressedFileReader::open, invalid header" << std::endl;
+		delete [] hdrBuffer;
+		close();
+		return false;
+	}
+	_stripes.resize(nStripes);
+	memcpy(_stripes.data(), p, nStripes * sizeof(StripeHeader));
+	p += nStripes * sizeof(StripeHeader);
+	/* the shared RAC dictionaries, if any, follow the stripe headers */
+	int sectionSize = hdrBuffer + hdrSize - p;
+	bool sectionValid = sectionSize == 0 || (_algorithm == RAC && _decompressor && ((RACDecompressorBase*) _decompressor)->loadSharedDictionaries(p, sectionSize));
+	delete [] hdrBuffer;
+	if(!_decompressor || !sectionValid) {
+		std::cout << "ERROR: CompressedFileReader::open, invalid header" << std::endl;
+		close();
+		return false;
+	}
+
+	/* the deduplicated RAC stripe dictionaries, if any, follow the last stripe; only their index is read at open and
+	 * each dictionary is fetched the first time a read needs it
+	 */
+	const StripeHeader& last = _stripes[nStripes-1];
+	long long int indexPos = _data_offset + last.offsetOfCompressedData + last.compressedStripeSize;
+	if(indexPos < _file_size) {
+		int nDicts = -1;
+		bool indexValid = _algorithm == RAC && indexPos + sizeof(int) <= _file_size && readAt((char*) &nDicts, sizeof(int), indexPos);
+		indexValid = indexValid && nDicts >= 0 && indexPos + sizeof(int) + (long long int) nDicts * sizeof(int) <= _file_size;
+		std::vector<char> index(indexValid ? sizeof(int) + nDicts * sizeof(int) : 0);
+		indexValid = indexValid && readAt(index.data(), index.size(), indexPos);
+		if(!indexValid || !((RACDecompressorBase*) _decompressor)->addLazyDictionaries(index.data(), index.size(), indexPos + index.size(), std::bind(&CompressedFileReader::readAt, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3))) {
+			std::cout << "ERROR: CompressedFileReader::open, invalid dictionary section after the payload" << std::endl;
+			close();
+			return false;
+		}
+	}
+
+	/* count the blocks in the last stripe; every other stripe is full */
+	long long int blockInLastStripe = (last.rawStripeSize-1)/_params.block_size+1;
+	if(_algorithm == SBC) {
+		blockInLastStripe = 1;
+	}
+	_number_of_blocks = (long long int) _params.number_of_blocks * (nStripes - 1) + blockInLastStripe;
+	_raw_size = (long long int) _params.block_size * _params.number_of_blocks * (nStripes - 1) + last.rawStripeSize;
+	return true;
+}
+
+void CompressedFileReader::close() {
+	if(_map_base) {
+		munmap((void*) _map_base, _file_size);
+		_map_base = NULL;
+	}
+	if(_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+	if(_decompressor) {
+		delete _decompressor;
+		_decompressor = NULL;
+	}
+	_stripes.clear();
+	_number_of_blocks = 0;
+	_raw_size = 0;
+}
+
+CompressionAlgorithm CompressedFileReader::getAlgorithm() {
+	return _algorithm;
+}
+
+CompressionParameter CompressedFileReader::getParams() {
+	return _params;
+}
+
+long long int CompressedFileReader::getFileSize() {
+	return _file_size;
+}
+
+int CompressedFileReader::getNumberOfStripes() {
+	return _stripes.size();
+}
+
+long long int CompressedFileReader::getNumberOfBlocks() {
+	return _number_of_blocks;
+}
+
+long long int CompressedFileReader::getRawSize() {
+	return _raw_size;
+}
+
+bool CompressedFileReader::readAt(char* buffer, int size, long long int pos) {
+	if(_map_base) {
+		memcpy(buffer, _map_base + pos, size);
+		return true;
+	}
+	int done = 0;
+	while(done < size) {
+		ssize_t rsize = pread(_fd, buffer + done, size - done, pos + done);
+		if(rsize <= 0) {
+			std::cout << "ERROR: CompressedFileReader::readAt, pread failed" << std::endl;
+			return false;
+		}
+		done += rsize;
+	}
+	return true;
+}
+
+const char* CompressedFileReader::fetchStripe(const StripeHeader& h, char* buffer) {
+	return fetchRange(_data_offset + h.offsetOfCompressedData, h.compressedStripeSize, buffer);
+}
+
+const char* CompressedFileReader::fetchRange(long long int pos, int size, char* buffer) {
+	if(_map_base) {
+		return _map_base + pos;
+	}
+	if(!readAt(buffer, size, pos)) {
+		return NULL;
+	}
+	return buffer;
+}
+
+int CompressedFileReader::readBlock(long long int globalBlockIdx, char* dst) {
+	if(globalBlockIdx < 0 || globalBlockIdx >= _number_of_blocks) {
+		std::cout << "ERROR: CompressedFileReader::readBlock, globalBlockIdx is not within range" << std::endl;
+		return -1;
+	}
+	int stripeIdx = globalBlockIdx / _params.number_of_blocks;
+	int blockIdx = globalBlockIdx % _params.number_of_blocks;
+	const StripeHeader& h = _stripes[stripeIdx];
+	int stripeSize = _params.block_size * _params.number_of_blocks;
+	int racPrefixBound = 2*sizeof(int) + _params.max_dict + _params.number_of_blocks*sizeof(StripeEntry);
+	int inSize = _algorithm == RAC && racPrefixBound + _params.block_size > stripeSize ? racPrefixBound + _params.block_size : stripeSize;
+	ReaderScratch& scratch = readerScratch();
+	scratch.reserve(inSize, stripeSize);
+	long long int stripePos = _data_offset + h.offsetOfCompressedData;
+	int stripeOffset = blockIdx * _params.block_size;
+	int len = h.rawStripeSize - stripeOffset < _params.block_size ? h.rawStripeSize - stripeOffset : _params.block_size;
+	if(h.compressedStripeSize == h.rawStripeSize) {
+		/* an uncompressed stripe is read only where the block lies */
+		if(!readAt(dst, len, stripePos + stripeOffset)) {
+			return -1;
+		}
+		return len;
+	}
+	if(_algorithm == RAC) {
+		/* one read for the dictionary and entry table, one for the compressed block */
+		int prefixSize = h.compressedStripeSize < racPrefixBound ? h.compressedStripeSize : racPrefixBound;
+		const char* racHeader = fetchRange(stripePos, prefixSize, scratch.buffer_in);
+		if(!racHeader) {
+			return -1;
+		}
+		int racHeaderSize = RACDecompressorBase::stripeHeaderSize(racHeader);
+		StripeEntry entry;
+		if(racHeaderSize > prefixSize || !RACDecompressorBase::getEntry(racHeader, blockIdx, entry)) {
+			std::cout << "ERROR: CompressedFileReader::readBlock, invalid RAC stripe header" << std::endl;
+			return -1;
+		}
+		const char* blockData = fetchRange(stripePos + racHeaderSize + entry.offsetOfCompressedData, entry.compressedBlockSize, scratch.buffer_in + racPrefixBound);
+		if(!blockData) {
+			return -1;
+		}
+		return ((RACDecompressorBase*) _decompressor)->decompressEntry(racHeader, entry, blockData, dst, _params.block_size);
+	}
+	const char* stripeBuffer = fetchStripe(h, scratch.buffer_in);
+	if(!stripeBuffer) {
+		return -1;
+	}
+	if(_algorithm == MBC) {
+		/* MBC decodes the whole stripe into scratch and hands back a pointer to the block */
+		char* oPtr = scratch.buffer_out;
+		if(_decompressor->decompressBlock(stripeBuffer, h.compressedStripeSize, oPtr, scratch.buffer_out_size, blockIdx) != len) {
+			std::cout << "ERROR: CompressedFileReader::readBlock, decompressBlock failed" << std::endl;
+			return -1;
+		}
+		memcpy(dst, oPtr, len);
+		return len;
+	}
+	char* oPtr = dst;
+	return _decompressor->decompressBlock(stripeBuffer, h.compressedStripeSize, oPtr, _params.block_size, blockIdx);
+}
+
+struct BlockRequestLess {
+	const std::vector<long long int>* idxs;
+	bool operator()(int a, int b) const {
+		return (*idxs)[a] < (*idxs)[b];
+	}
+};
+
+int CompressedFileReader::readBlocks(const std::vector<long long int>& globalBlockIdxs, char* dst, std::vector<int>& sizes) {
+	int nRequests = globalBlockIdxs.size();
+	sizes.assign(nRequests, -1);
+	/* visit the requests sorted by block so that requests for the same stripe are adjacent */
+	std::vector<int> order;
+	for(int i = 0; i < nRequests; ++i) {
+		if(globalBlockIdxs[i] < 0 || globalBlockIdxs[i] >= _number_of_blocks) {
+			std::cout << "ERROR: CompressedFileReader::readBlocks, globalBlockIdx is not within range" << std::endl;
+			continue;
+		}
+		order.push_back(i);
+	}
+	BlockRequestLess less = {&globalBlockIdxs};
+	std::sort(order.begin(), order.end(), less);
+
+	int blockSize = _params.block_size;
+	int stripeSize = blockSize * _params.number_of_blocks;
+	ReaderScratch& scratch = readerScratch();
+	scratch.reserve(stripeSize, stripeSize);
+	int nRead = 0;
+	std::vector<int> blockIdxs;
+	std::vector<char*> dstBuffers;
+	std::vector<int> dstSizes;
+	int first = 0;
+	while(first < order.size()) {
+		int stripeIdx = globalBlockIdxs[order[first]] / _params.number_of_blocks;
+		int last = first;
+		while(last < order.size() && globalBlockIdxs[order[last]] / _params.number_of_blocks == stripeIdx) {
+			last++;
+		}
+		const StripeHeader& h = _stripes[stripeIdx];
+		const char* stripeBuffer = fetchStripe(h, scratch.buffer_in);
+		if(!stripeBuffer) {
+			first = last;
+			continue;
+		}
+		if(h.compressedStripeSize == h.rawStripeSize || _algorithm == MBC) {
+			/* raw stripes are copied from; compressed MBC stripes are decoded once into scratch */
+			const char* raw = stripeBuffer;
+			if(h.compressedStripeSize != h.rawStripeSize) {
+				char* oPtr = scratch.buffer_out;
+				if(_decompressor->decompressStripe(stripeBuffer, h.compressedStripeSize, oPtr, stripeSize) != h.rawStripeSize) {
+					std::cout << "ERROR: CompressedFileReader::readBlocks, decompressStripe failed" << std::endl;
+					first = last;
+					continue;
+				}
+				raw = scratch.buffer_out;
+			}
+			for(int r = first; r < last; ++r) {
+				int blockIdx = globalBlockIdxs[order[r]] % _params.number_of_blocks;
+				int stripeOffset = blockIdx * blockSize;
+				int len = h.rawStripeSize - stripeOffset < blockSize ? h.rawStripeSize - stripeOffset : blockSize;
+				memcpy(dst + (long long int) order[r] * blockSize, raw + stripeOffset, len);
+				sizes[order[r]] = len;
+				nRead++;
+			}
+		} else if(_algorithm == RAC) {
+			blockIdxs.clear();
+			dstBuffers.clear();
+			for(int r = first; r < last; ++r) {
+				blockIdxs.push_back(globalBlockIdxs[order[r]] % _params.number_of_blocks);
+				dstBuffers.push_back(dst + (long long int) order[r] * blockSize);
+			}
+			nRead += ((RACDecompressorBase*) _decompressor)->decompressBlocks(stripeBuffer, h.compressedStripeSize, blockIdxs, dstBuffers, dstSizes);
+			for(int r = first; r < last; ++r) {
+				sizes[order[r]] = dstSizes[r - first];
+			}
+		} else {
+			/* an SBC stripe is a single block; decode it once and copy it to duplicate requests */
+			char* oPtr = dst + (long long int) order[first] * blockSize;
+			int decSize = _decompressor->decompressBlock(stripeBuffer, h.compressedStripeSize, oPtr, blockSize, 0);
+			for(int r = first; r < last && decSize >= 0; ++r) {
+				if(r > first) {
+					memcpy(dst + (long long int) order[r] * blockSize, oPtr, decSize);
+				}
+				sizes[order[r]] = decSize;
+				nRead++;
+			}
+		}
+		first = last;
+	}
+	return nRead;
+}
+
+long long int CompressedFileReader::readRange(long long int offset, long long int length, char* dst) {
+	if(offset < 0 || length < 0 || offset > _raw_size) {
+		std::cout << "ERROR: CompressedFileReader::readRange, offset is not within range" << std::endl;
+		return -1;
+	}
+	long long int end = offset + length < _raw_size ? offset + length : _raw_size;
+	if(offset == end) {
+		return 0;
+	}
+	int blockSize = _params.block_size;
+	int stripeSize = blockSize * _params.number_of_blocks;
+	int racPrefixBound = 2*sizeof(int) + _params.max_dict + _params.number_of_blocks*sizeof(StripeEntry);
+	int inSize = _algorithm == RAC ? racPrefixBound + stripeSize : stripeSize;
+	ReaderScratch& scratch = readerScratch();
+	scratch.reserve(inSize, stripeSize);
+	for(int stripeIdx = offset / stripeSize; stripeIdx <= (end - 1) / stripeSize; ++stripeIdx) {
+		const StripeHeader& h = _stripes[stripeIdx];
+		long long int stripeStart = (long long int) stripeIdx * stripeSize;
+		long long int stripePos = _data_offset + h.offsetOfCompressedData;
+		/* [lo, hi) is the part of the range inside this stripe, out is where it goes in dst */
+		int lo = offset > stripeStart ? offset - stripeStart : 0;
+		int hi = end < stripeStart + h.rawStripeSize ? end - stripeStart : h.rawStripeSize;
+		char* out = dst + (stripeStart + lo - offset);
+		if(h.compressedStripeSize == h.rawStripeSize) {
+			if(!readAt(out, hi - lo, stripePos + lo)) {
+				return -1;
+			}
+		} else if(_algorithm == RAC) {
+			int prefixSize = h.compressedStripeSize < racPrefixBound ? h.compressedStripeSize : racPrefixBound;
+			const char* racHeader = fetchRange(stripePos, prefixSize, scratch.buffer_in);
+			if(!racHeader) {
+				return -1;
+			}
+			int racHeaderSize = RACDecompressorBase::stripeHeaderSize(racHeader);
+			int firstBlock = lo / blockSize;
+			int lastBlock = (hi - 1) / blockSize;
+			StripeEntry first, last;
+			if(racHeaderSize > prefixSize || !RACDecompressorBase::getEntry(racHeader, firstBlock, first) || !RACDecompressorBase::getEntry(racHeader, lastBlock, last)) {
+				std::cout << "ERROR: CompressedFileReader::readRange, invalid RAC stripe header" << std::endl;
+				return -1;
+			}
+			/* blocks are stored in order, so the overlapping ones are fetched with a single read */
+			int fetchSize = last.offsetOfCompressedData + last.compressedBlockSize - first.offsetOfCompressedData;
+			const char* blockData = fetchRange(stripePos + racHeaderSize + first.offsetOfCompressedData, fetchSize, scratch.buffer_in + racPrefixBound);
+			if(!blockData) {
+				return -1;
+			}
+			for(int blockIdx = firstBlock; blockIdx <= lastBlock; ++blockIdx) {
+				StripeEntry entry;
+				RACDecompressorBase::getEntry(racHeader, blockIdx, entry);
+				int blockStart = blockIdx * blockSize;
+				int blockEnd = blockStart + entry.rawBlockSize;
+				const char* src = blockData + entry.offsetOfCompressedData - first.offsetOfCompressedData;
+				if(blockStart >= lo && blockEnd <= hi) {
+					if(((RACDecompressorBase*) _decompressor)->decompressEntry(racHeader, entry, src, out + (blockStart - lo), entry.rawBlockSize) != entry.rawBlockSize) {
+						return -1;
+					}
+				} else {
+					/* the unaligned head or tail block is decoded aside and only its overlap copied */
+					if(((RACDecompressorBase*) _decompressor)->decompressEntry(racHeader, entry, src, scratch.buffer_out, blockSize) != entry.rawBlockSize) {
+						return -1;
+					}
+					int from = lo > blockStart ? lo : blockStart;
+					int to = hi < blockEnd ? hi : blockEnd;
+					memcpy(out + (from - lo), scratch.buffer_out + (from - blockStart), to - from);
+				}
+			}
+		} else {
+			const char* stripeBuffer = fetchStripe(h, scratch.buffer_in);
+			if(!stripeBuffer) {
+				return -1;
+			}
+			if(lo == 0 && hi == h.rawStripeSize) {
+				char* oPtr = out;
+				if(_decompressor->decompressStripe(stripeBuffer, h.compressedStripeSize, oPtr, h.rawStripeSize) != h.rawStripeSize) {
+					std::cout << "ERROR: CompressedFileReader::readRange, decompressStripe failed" << std::endl;
+					return -1;
+				}
+			} else {
+				/* MBC decodes the stripe up to the block holding hi into scratch; an SBC stripe is one block */
+				char* oPtr = scratch.buffer_out;
+				int lastBlock = (hi - 1) / blockSize;
+				int expected = h.rawStripeSize;
+				if(_algorithm == MBC) {
+					expected = h.rawStripeSize - lastBlock * blockSize < blockSize ? h.rawStripeSize - lastBlock * blockSize : blockSize;
+				}
+				if(_decompressor->decompressBlock(stripeBuffer, h.compressedStripeSize, oPtr, scratch.buffer_out_size, lastBlock) != expected) {
+					std::cout << "ERROR: CompressedFileReader::readRange, decompressBlock failed" << std::endl;
+					return -1;
+				}
+				memcpy(out, scratch.buffer_out + lo, hi - lo);
+			}
+		}
+	}
+	return end - offset;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "common.h"
+
+// one read of a recorded trace, in bytes of the uncompressed file
+struct TraceRecord {
+	double timestamp; // seconds
+	long long int offset;
+	long long int length;
+};
+
+/* Load a block-access trace. Each line holds a timestamp in seconds, an offset and a length, separated by
+ * whitespace or commas; empty lines and lines starting with '#' are skipped. With BlockTrace the offset is a
+ * block number and the length a number of blocks (1 when omitted), which are turned into bytes with blockSize.
+ * Records are returned in file order. Returns false if the file cannot be opened or a line cannot be parsed.
+ */
+inline bool loadTrace(std::string trace_name, TraceUnit unit, int blockSize, std::vector<TraceRecord>& records) {
+	records.clear();
+	FILE* fp = fopen(trace_name.c_str(), "r");
+	if(!fp) {
+		std::cout << "ERROR: loadTrace, cannot open " << trace_name << std::endl;
+		return false;
+	}
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+	while(fgets(line, sizeof(line), fp)) {
+		lineNumber++;
+		for(char* c = line; *c; ++c) {
+			if(*c == ',') {
+				*c = ' ';
+			}
+		}
+		char first = 0;
+		if(sscanf(line, " %c", &first) != 1 || first == '#') {
+			continue;
+		}
+		TraceRecord r;
+		r.length = unit == BlockTrace ? 1 : 0;
+		int n = sscanf(line, "%lf %lld %lld", &r.timestamp, &r.offset, &r.length);
+		if(n < 2 || (n == 2 && unit == ByteTrace) || r.offset < 0 || r.length < 0) {
+			std::cout << "ERROR: loadTrace, cannot parse line " << lineNumber << " of " << trace_name << std::endl;
+			ok = false;
+			break;
+		}
+		if(unit == BlockTrace) {
+			r.offset *= blockSize;
+			r.length *= blockSize;
+		}
+		records.push_back(r);
+	}
+	fclose(fp);
+	return ok;
+}
+
+#endif
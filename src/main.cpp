@@ -12,22 +12,85 @@ static void show_usage(std::string name)
 		<< "Options:\n"
 		<< "\t-h,--help\t\t\tShow this help message\n"
 		<< "\t-t,--test\t\t\tTest case [sbc(single block compression), mbc(multiple block compression), rac(random access compression)]\n"
+		<< "\t-z,--codec\t\tBlock codec[lz4, lz4hc, zstd]\n"
+		<< "\t-l,--level\t\tCompression level of zstd and lz4hc (0 uses the codec's default)\n"
+		<< "\t--acceleration\t\tAcceleration of lz4, higher is faster with a lower ratio (default 1)\n"
 		<< "\t-b,--block-size\t\tSpecify the block size\n"
 		<< "\t-n,--number-of-block\tSpecify how many blocks for each compressing step\n"
 		<< "\t-d,--max-dict\t\tMaximum dictionary size for Random Access Compression(RAC)\n"
 		<< "\t-k,--kmer-size\t\tK-mer size in Rolling K-mer algorithm to generate dictionary\n"
 		<< "\t-s,--segment-size\tSegment size in Rolling K-mer algorithm to generate dicitonary\n"
-		<< "\t-w,--workload\t\tWorkload type to test[random-read, sequential-read, sequential-write]\n"
+		<< "\t-w,--workload\t\tWorkload type to test[random-read, concurrent-random-read, sequential-read, sequential-write, trace-replay]\n"
 		<< "\t-i,--input-file\t\tInput file name\n"
 		<< "\t-o,--output-file\tOutput file name\n"
+		<< "\t-a,--dictionary-algorithm\tDictionary algorithm for RAC[rolling-kmer, suffix-array, fast-cover, native-kmer]\n"
+		<< "\t--dict-threads\t\tThreads of the dictionary optimizer; it tries segment sizes in parallel when -s is 0 and k-mer sizes 6 and 8 when -k is 0\n"
+		<< "\t--fastcover-f\t\tlog2 of the k-mer frequency table of fast-cover, in [0, 31] (default 20)\n"
+		<< "\t--fastcover-accel\tSpeed over accuracy of fast-cover, in [0, 10] (default 1); fast-cover needs -k 6 or 8\n"
+		<< "\t--dict-sample-fraction\tFraction of the blocks of a RAC stripe the dictionary is trained on, in (0, 1] (default 1)\n"
+		<< "\t--dict-sample-blocks\tNumber of blocks of a RAC stripe the dictionary is trained on; overrides the fraction when > 0\n"
+		<< "\t--dict-sampling\t\tHow the sampled blocks are chosen[stride, random]\n"
+		<< "\t--dict-budget-ms\tMilliseconds a RAC stripe waits for its dictionary (default 0, no limit)\n"
+		<< "\t--dict-fallback\t\tWhat a stripe over the budget is compressed with[none, previous]\n"
+		<< "\t--shared-dicts\t\tTrain this many RAC dictionaries for the whole file and store them in its header (default 0, one per stripe)\n"
+		<< "\t--dedup-dicts\t\tStore identical RAC stripe dictionaries once, after the payload, and let stripes refer to them[off, on] (default off)\n"
+		<< "\t--dict-drift\t\tReuse the previous RAC stripe's dictionary until a probe compresses this fraction worse, e.g. 0.05 (default 0, train one per stripe)\n"
+		<< "\t-j,--threads\t\tNumber of threads to compress/decompress stripes in parallel, or reader threads for concurrent-random-read\n"
+#if !MBC_COVER_CONCURRENT
+		<< "\t\t\t\tThis zstd has no thread-safe COVER, so rolling-kmer trains one RAC stripe at a time whatever -j is\n"
+#endif
+		<< "\t-e,--io-engine\t\tHow random-read fetches stripes[stdio, pread, mmap]\n"
+		<< "\t-q,--qps\t\tTarget requests per second; runs random-read open loop when > 0\n"
+		<< "\t-r,--arrival\t\tInter-arrival distribution of open-loop random-read[poisson, constant]\n"
+		<< "\t-c,--cache-size\t\tBytes of decoded SBC/MBC stripes or RAC dictionaries random-read may cache (0 disables)\n"
+		<< "\t-p,--cache-policy\tEviction policy of the stripe cache[lru, fifo]\n"
+		<< "\t-x,--access-pattern\tBlocks the random-read workloads visit[uniform, zipf, hotcold, strided, sequential]\n"
+		<< "\t--zipf-theta\t\tSkew of the zipf access pattern, in (0, 1)\n"
+		<< "\t--hot-fraction\t\tFraction of the blocks in the hot set of the hotcold access pattern\n"
+		<< "\t--hot-probability\tFraction of the reads that go to the hot set of the hotcold access pattern\n"
+		<< "\t--stride\t\tBlocks between two reads of the strided access pattern\n"
+		<< "\t--run-length\t\tBlocks per run of the sequential access pattern\n"
+		<< "\t-N,--reads\t\tNumber of measured reads (0 reads as many blocks as the file has)\n"
+		<< "\t--warmup\t\tNumber of unmeasured reads issued before the measured ones\n"
+		<< "\t--seed\t\t\tSeed of the access pattern\n"
+		<< "\t-T,--trace\t\tTrace file of trace-replay, one \"timestamp offset length\" per line\n"
+		<< "\t--trace-unit\t\tWhether trace offsets and lengths are bytes or blocks[byte, block]\n"
+		<< "\t--replay\t\tIssue trace reads back to back or at their timestamps[fast, timed]\n"
 		<< std::endl;
 }
 
-static void print_csv(std::string test, int block_size, int number_of_blocks, int max_dict, int kmer_size, int segment_size, std::string wl, std::string file_in, std::string file_out, std::string dictionary_algorithm)
+// p50, p99, p99.9 and max of one per-call latency histogram, in microseconds
+static void print_histogram_csv(const LatencyHistogram& histogram)
 {
+	std::cout << "," << histogram.percentile(50) / 1e3 << "," << histogram.percentile(99) / 1e3 << "," << histogram.percentile(99.9) / 1e3 << "," << histogram.max() / 1e3;
+}
+
+static void print_csv(std::string test, int block_size, int number_of_blocks, int max_dict, int kmer_size, int segment_size, std::string wl, std::string file_in, std::string file_out, std::string dictionary_algorithm, int number_of_threads, std::string io_engine, double target_qps, std::string arrival, long long int cache_size, std::string cache_policy, std::string access_pattern, const AccessParameter& access, std::string trace_name, std::string replay, std::string codec, int level, int acceleration, int shared_dictionaries, double dictionary_drift, const TrainerParameter& trainer, std::string dict_sampling, std::string dict_fallback)
+{
+	gStats.collect();
 	std::cout << test << "," << block_size << "," << number_of_blocks << "," << max_dict << "," << kmer_size << "," << segment_size << "," << wl << "," << file_in << "," << file_out << ","
 		<< gStats.dictionary_timer.count() << "," << gStats.compression_timer.count() << "," << gStats.decompression_timer.count() << ","
-		<< gStats.total_dictionary_size << "," << gStats.total_raw_size << "," << gStats.total_compressed_size << "," << gStats.total_decompressed_size << "," << dictionary_algorithm << std::endl;
+		<< gStats.total_dictionary_size << "," << gStats.total_raw_size << "," << gStats.total_compressed_size << "," << gStats.total_decompressed_size << "," << dictionary_algorithm << "," << number_of_threads << "," << io_engine << ","
+		<< gStats.total_read_blocks << "," << gStats.read_wall_timer.count() << "," << gStats.read_blocks_per_second() << "," << gStats.read_mb_per_second() << ","
+		<< target_qps << "," << arrival << "," << gStats.read_latency_percentile(50) * 1e6 << "," << gStats.read_latency_percentile(90) * 1e6 << ","
+		<< gStats.read_latency_percentile(99) * 1e6 << "," << gStats.read_latency_percentile(99.9) * 1e6;
+	std::cout << "," << cache_size << "," << cache_policy << "," << gStats.cache_hit_ratio() << "," << gStats.decode_amplification() << "," << gStats.total_io_bytes << "," << gStats.io_amplification() << "," << gStats.mbc_average_decoded_fraction();
+	std::cout << "," << access_pattern << "," << access.number_of_reads << "," << access.warmup_reads << "," << access.seed;
+	std::cout << "," << trace_name << "," << replay << "," << codec << "," << level << "," << acceleration << "," << shared_dictionaries << "," << gStats.total_deduplicated_dictionary_size;
+	std::cout << "," << dictionary_drift << "," << gStats.dict_reused_stripes << "," << gStats.dict_retrained_stripes;
+	std::cout << "," << trainer.threads << "," << trainer.f << "," << trainer.accel;
+	std::cout << "," << trainer.sample_fraction << "," << trainer.sample_blocks << "," << dict_sampling << "," << trainer.budget_ms << "," << dict_fallback << "," << gStats.dict_budget_overruns;
+	print_histogram_csv(gStats.compress_stripe_histogram);
+	print_histogram_csv(gStats.generate_dict_histogram);
+	print_histogram_csv(gStats.decompress_stripe_histogram);
+	print_histogram_csv(gStats.decompress_block_histogram);
+	std::cout << std::endl;
+	// one extra row per reader thread: thread id, reads, mean and max latency in microseconds
+	for(int t = 0; t < gStats.read_threads.size(); ++t) {
+		const ReadThreadStats& r = gStats.read_threads[t];
+		double mean = r.reads > 0 ? r.latency_sum.count() / r.reads : 0;
+		std::cout << "thread," << r.thread << "," << r.reads << "," << mean * 1e6 << "," << r.latency_max.count() * 1e6 << std::endl;
+	}
 }
 
 int main(int argc, char* argv[])
@@ -42,12 +105,47 @@ int main(int argc, char* argv[])
 	int max_dict = DEFAULT_MaxDict;
 	int kmer_size = DEFAULT_KmerSize;
 	int segment_size = DEFAULT_SegmentSize;
+	int number_of_threads = DEFAULT_NumberOfThreads;
 	std::string wl;
 	Workload workload = SequentialWrite;
 	std::string file_in;
 	std::string file_out;
-	std::string dictionary_algorithm;
+	std::string dictionary_algorithm = "rolling-kmer";
+	std::string io_engine = "stdio";
+	double target_qps = DEFAULT_TargetQPS;
+	std::string arrival = "poisson";
+	long long int cache_size = DEFAULT_CacheSize;
+	std::string cache_policy = "lru";
+	std::string access_pattern = "uniform";
+	std::string trace_name;
+	std::string replay = "fast";
+	std::string codec = "lz4";
+	std::string dict_sampling = "stride";
+	std::string dict_fallback = "none";
+	int level = DEFAULT_Level;
+	int acceleration = DEFAULT_Acceleration;
+	int shared_dictionaries = DEFAULT_SharedDictionaries;
+	double dictionary_drift = DEFAULT_DictDrift;
+	std::string dedup_dicts = DEFAULT_DictDedup ? "on" : "off";
+	TrainerParameter trainer = defaultTrainerParameter();
 	GlobalParams params;
+	params.codec = LZ4Codec;
+	params.level = level;
+	params.acceleration = acceleration;
+	params.dictionary_algorithm = RollingKmer;
+	params.shared_dictionaries = shared_dictionaries;
+	params.dictionary_drift = dictionary_drift;
+	params.dictionary_dedup = DEFAULT_DictDedup;
+	params.trainer = trainer;
+	params.number_of_threads = number_of_threads;
+	params.io_engine = StdioEngine;
+	params.target_qps = target_qps;
+	params.arrival = PoissonArrival;
+	params.cache_size = cache_size;
+	params.cache_policy = LRUCache;
+	params.access = defaultAccessParameter();
+	params.trace_unit = ByteTrace;
+	params.replay_mode = FastReplay;
 	for (int i = 1; i < argc; ++i) {
 		std::string arg = argv[i];
 		if ((arg == "-h") || (arg == "--help")) {
@@ -66,6 +164,37 @@ int main(int argc, char* argv[])
 			} else {
 				std::cerr << "--test-case option require one argument." << std::endl;
 			}
+		} else if ((arg == "-z") || (arg == "--codec")) {
+			if (i + 1 < argc) {
+				codec = std::string(argv[++i]);
+				if(codec == "lz4") {
+					params.codec = LZ4Codec;
+				} else if(codec == "zstd") {
+					params.codec = ZSTDCodec;
+				} else if(codec == "lz4hc") {
+					params.codec = LZ4HCCodec;
+				} else {
+					std::cerr << "Invalid codec" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--codec option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-l") || (arg == "--level")) {
+			if (i + 1 < argc) {
+				level = std::atoi(argv[++i]);
+				params.level = level;
+			} else {
+				std::cerr << "--level option requires one argument." << std::endl;
+			}
+		} else if (arg == "--acceleration") {
+			if (i + 1 < argc) {
+				acceleration = std::atoi(argv[++i]);
+				params.acceleration = acceleration;
+			} else {
+				std::cerr << "--acceleration option requires one argument." << std::endl;
+			}
 		} else if ((arg == "-b") || (arg == "--block-size")) {
 			if (i + 1 < argc) { // Make sure we aren't at the end of argv!
 				block_size = std::atoi(argv[++i]); // Increment 'i' so we don't get the argument as the next argv[i].
@@ -107,10 +236,14 @@ int main(int argc, char* argv[])
 				wl = std::string(argv[++i]);
 				if(wl == "random-read") {
 					workload = RandomRead;
+				} else if(wl == "concurrent-random-read") {
+					workload = ConcurrentRandomRead;
 				} else if(wl == "sequential-read") {
 					workload = SequentialRead;
 				} else if(wl == "sequential-write") {
 					workload = SequentialWrite;
+				} else if(wl == "trace-replay") {
+					workload = TraceReplay;
 				} else {
 					std::cerr << "Invalid workload" << std::endl;
 					show_usage(argv[0]);
@@ -133,10 +266,301 @@ int main(int argc, char* argv[])
 		} else if ((arg == "-a") || (arg == "--dictionary-algorithm")) {
 			if (i + 1 < argc) {
 				dictionary_algorithm = std::string(argv[++i]);
-				params.dictionary_algorithm = dictionary_algorithm;
+				if(dictionary_algorithm == "rolling-kmer") {
+					params.dictionary_algorithm = RollingKmer;
+				} else if(dictionary_algorithm == "suffix-array") {
+					params.dictionary_algorithm = SuffixArray;
+				} else if(dictionary_algorithm == "native-kmer") {
+					params.dictionary_algorithm = NativeKmer;
+#if ZSTD_VERSION_NUMBER >= 10306
+				} else if(dictionary_algorithm == "fast-cover") {
+					params.dictionary_algorithm = FastCover;
+#endif
+				} else {
+					std::cerr << "Invalid dictionary algorithm" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
 			} else {
 				std::cerr << "--dictionary-algorithm option requires one argument." << std::endl;
 			}
+		} else if (arg == "--shared-dicts") {
+			if (i + 1 < argc) {
+				shared_dictionaries = std::atoi(argv[++i]);
+				params.shared_dictionaries = shared_dictionaries;
+			} else {
+				std::cerr << "--shared-dicts option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-threads") {
+			if (i + 1 < argc) {
+				trainer.threads = std::atoi(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-threads option requires one argument." << std::endl;
+			}
+		} else if (arg == "--fastcover-f") {
+			if (i + 1 < argc) {
+				trainer.f = std::atoi(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--fastcover-f option requires one argument." << std::endl;
+			}
+		} else if (arg == "--fastcover-accel") {
+			if (i + 1 < argc) {
+				trainer.accel = std::atoi(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--fastcover-accel option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-sample-fraction") {
+			if (i + 1 < argc) {
+				trainer.sample_fraction = std::atof(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-sample-fraction option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-sample-blocks") {
+			if (i + 1 < argc) {
+				trainer.sample_blocks = std::atoi(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-sample-blocks option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-sampling") {
+			if (i + 1 < argc) {
+				dict_sampling = std::string(argv[++i]);
+				if(dict_sampling == "stride") {
+					trainer.sampling = StrideSampling;
+				} else if(dict_sampling == "random") {
+					trainer.sampling = RandomSampling;
+				} else {
+					std::cerr << "Invalid dictionary sampling" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-sampling option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-budget-ms") {
+			if (i + 1 < argc) {
+				trainer.budget_ms = std::atof(argv[++i]);
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-budget-ms option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-fallback") {
+			if (i + 1 < argc) {
+				dict_fallback = std::string(argv[++i]);
+				if(dict_fallback == "none") {
+					trainer.fallback = NoDictionary;
+				} else if(dict_fallback == "previous") {
+					trainer.fallback = PreviousDictionary;
+				} else {
+					std::cerr << "Invalid dictionary fallback" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+				params.trainer = trainer;
+			} else {
+				std::cerr << "--dict-fallback option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dedup-dicts") {
+			if (i + 1 < argc) {
+				dedup_dicts = std::string(argv[++i]);
+				if(dedup_dicts == "off") {
+					params.dictionary_dedup = false;
+				} else if(dedup_dicts == "on") {
+					params.dictionary_dedup = true;
+				} else {
+					std::cerr << "Invalid dictionary dedup mode" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--dedup-dicts option requires one argument." << std::endl;
+			}
+		} else if (arg == "--dict-drift") {
+			if (i + 1 < argc) {
+				dictionary_drift = std::atof(argv[++i]);
+				params.dictionary_drift = dictionary_drift;
+			} else {
+				std::cerr << "--dict-drift option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-j") || (arg == "--threads")) {
+			if (i + 1 < argc) {
+				number_of_threads = std::atoi(argv[++i]);
+				params.number_of_threads = number_of_threads;
+			} else {
+				std::cerr << "--threads option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-e") || (arg == "--io-engine")) {
+			if (i + 1 < argc) {
+				io_engine = std::string(argv[++i]);
+				if(io_engine == "stdio") {
+					params.io_engine = StdioEngine;
+				} else if(io_engine == "pread") {
+					params.io_engine = PreadEngine;
+				} else if(io_engine == "mmap") {
+					params.io_engine = MmapEngine;
+				} else {
+					std::cerr << "Invalid io engine" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--io-engine option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-q") || (arg == "--qps")) {
+			if (i + 1 < argc) {
+				target_qps = std::atof(argv[++i]);
+				params.target_qps = target_qps;
+			} else {
+				std::cerr << "--qps option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-r") || (arg == "--arrival")) {
+			if (i + 1 < argc) {
+				arrival = std::string(argv[++i]);
+				if(arrival == "poisson") {
+					params.arrival = PoissonArrival;
+				} else if(arrival == "constant") {
+					params.arrival = ConstantArrival;
+				} else {
+					std::cerr << "Invalid arrival" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--arrival option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-c") || (arg == "--cache-size")) {
+			if (i + 1 < argc) {
+				cache_size = std::atoll(argv[++i]);
+				params.cache_size = cache_size;
+			} else {
+				std::cerr << "--cache-size option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-p") || (arg == "--cache-policy")) {
+			if (i + 1 < argc) {
+				cache_policy = std::string(argv[++i]);
+				if(cache_policy == "lru") {
+					params.cache_policy = LRUCache;
+				} else if(cache_policy == "fifo") {
+					params.cache_policy = FIFOCache;
+				} else {
+					std::cerr << "Invalid cache policy" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--cache-policy option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-x") || (arg == "--access-pattern")) {
+			if (i + 1 < argc) {
+				access_pattern = std::string(argv[++i]);
+				if(access_pattern == "uniform") {
+					params.access.distribution = UniformAccess;
+				} else if(access_pattern == "zipf") {
+					params.access.distribution = ZipfAccess;
+				} else if(access_pattern == "hotcold") {
+					params.access.distribution = HotColdAccess;
+				} else if(access_pattern == "strided") {
+					params.access.distribution = StridedAccess;
+				} else if(access_pattern == "sequential") {
+					params.access.distribution = SequentialAccess;
+				} else {
+					std::cerr << "Invalid access pattern" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--access-pattern option requires one argument." << std::endl;
+			}
+		} else if (arg == "--zipf-theta") {
+			if (i + 1 < argc) {
+				params.access.zipf_theta = std::atof(argv[++i]);
+			} else {
+				std::cerr << "--zipf-theta option requires one argument." << std::endl;
+			}
+		} else if (arg == "--hot-fraction") {
+			if (i + 1 < argc) {
+				params.access.hot_fraction = std::atof(argv[++i]);
+			} else {
+				std::cerr << "--hot-fraction option requires one argument." << std::endl;
+			}
+		} else if (arg == "--hot-probability") {
+			if (i + 1 < argc) {
+				params.access.hot_probability = std::atof(argv[++i]);
+			} else {
+				std::cerr << "--hot-probability option requires one argument." << std::endl;
+			}
+		} else if (arg == "--stride") {
+			if (i + 1 < argc) {
+				params.access.stride = std::atoll(argv[++i]);
+			} else {
+				std::cerr << "--stride option requires one argument." << std::endl;
+			}
+		} else if (arg == "--run-length") {
+			if (i + 1 < argc) {
+				params.access.run_length = std::atoi(argv[++i]);
+			} else {
+				std::cerr << "--run-length option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-N") || (arg == "--reads")) {
+			if (i + 1 < argc) {
+				params.access.number_of_reads = std::atoll(argv[++i]);
+			} else {
+				std::cerr << "--reads option requires one argument." << std::endl;
+			}
+		} else if (arg == "--warmup") {
+			if (i + 1 < argc) {
+				params.access.warmup_reads = std::atoll(argv[++i]);
+			} else {
+				std::cerr << "--warmup option requires one argument." << std::endl;
+			}
+		} else if (arg == "--seed") {
+			if (i + 1 < argc) {
+				params.access.seed = (unsigned int) std::atoll(argv[++i]);
+			} else {
+				std::cerr << "--seed option requires one argument." << std::endl;
+			}
+		} else if ((arg == "-T") || (arg == "--trace")) {
+			if (i + 1 < argc) {
+				trace_name = std::string(argv[++i]);
+				params.trace_name = trace_name;
+			} else {
+				std::cerr << "--trace option requires one argument." << std::endl;
+			}
+		} else if (arg == "--trace-unit") {
+			if (i + 1 < argc) {
+				std::string unit = std::string(argv[++i]);
+				if(unit == "byte") {
+					params.trace_unit = ByteTrace;
+				} else if(unit == "block") {
+					params.trace_unit = BlockTrace;
+				} else {
+					std::cerr << "Invalid trace unit" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--trace-unit option requires one argument." << std::endl;
+			}
+		} else if (arg == "--replay") {
+			if (i + 1 < argc) {
+				replay = std::string(argv[++i]);
+				if(replay == "fast") {
+					params.replay_mode = FastReplay;
+				} else if(replay == "timed") {
+					params.replay_mode = TimedReplay;
+				} else {
+					std::cerr << "Invalid replay mode" << std::endl;
+					show_usage(argv[0]);
+					return 1;
+				}
+			} else {
+				std::cerr << "--replay option requires one argument." << std::endl;
+			}
 		}
 	}
 	Filer filer;
@@ -145,9 +569,15 @@ int main(int argc, char* argv[])
 		filer.compressFile(file_in, file_out);
 	} else if(workload == SequentialRead) {
 		filer.decompressFile(file_in, file_out);
+	} else if(workload == RandomRead && target_qps > 0) {
+		filer.openLoopDecompressBlock(file_in);
 	} else if(workload == RandomRead) {
 		filer.decompressBlock(file_in, file_out);
+	} else if(workload == ConcurrentRandomRead) {
+		filer.concurrentDecompressBlock(file_in);
+	} else if(workload == TraceReplay) {
+		filer.replayTrace(file_in);
 	}
-	print_csv(test, block_size, number_of_blocks, max_dict, kmer_size, segment_size, wl, file_in, file_out, dictionary_algorithm);
+	print_csv(test, block_size, number_of_blocks, max_dict, kmer_size, segment_size, wl, file_in, file_out, dictionary_algorithm, number_of_threads, io_engine, target_qps, arrival, cache_size, cache_policy, access_pattern, params.access, trace_name, replay, codec, level, acceleration, shared_dictionaries, dictionary_drift, trainer, dict_sampling, dict_fallback);
 	return 0;
 }
@@ -1,3 +1,5 @@
+#include <chrono>
+#include <thread>
 #include "common.h"
 #include "compressor.hpp"
 #include "decompressor.hpp"
@@ -21,6 +23,9 @@ protected:
 		params.max_dict = 0;
 		params.k = 0;
 		params.d = 0;
+		params.codec = LZ4Codec;
+		params.level = 0;
+		params.acceleration = 1;
 		_sbc_c = new SBCCompressor(params);
 		_sbc_d = new SBCDecompressor(params);
 		params.number_of_blocks = 4;
@@ -406,6 +411,365 @@ TEST_F(CompressionTest, RACTestRandomRead) {
 }
 
 
+TEST_F(CompressionTest, RACTestTrainers) {
+	int numberOfBlocks = 256;
+	int blockSize = 4096;
+	int srcSize = numberOfBlocks * blockSize;
+	char* srcBuffer = new char[srcSize];
+	for(int i = 0; i < srcSize; ++i) {
+		srcBuffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	int stripeCapacity = srcSize * 2;
+	char* dstBuffer = new char[stripeCapacity];
+	char* decBuffer = new char[srcSize];
+	/* fixed (k, d) on one thread, the optimizer searching k on four, FastCover, and the suffix array */
+	DictionaryAlgorithm algorithms[4] = {RollingKmer, RollingKmer, FastCover, SuffixArray};
+	int segmentSizes[4] = {64, 0, 64, 64};
+	int threads[4] = {1, 4, 2, 1};
+	for(int t = 0; t < 4; ++t) {
+		CompressionParameter params = {blockSize, numberOfBlocks, 4096, segmentSizes[t], 8, LZ4Codec, 0, 1};
+		RACCompressor c(params);
+		TrainerParameter trainer = defaultTrainerParameter();
+		trainer.threads = threads[t];
+		c.setTrainerParameter(trainer);
+		int cmpSize = c.compressStripe(srcBuffer, srcSize, dstBuffer, stripeCapacity, algorithms[t]);
+		EXPECT_LT(cmpSize, srcSize);
+		int dictSize = 0;
+		memcpy(&dictSize, dstBuffer, sizeof(int));
+		EXPECT_GT(dictSize, 0);
+		EXPECT_LE(dictSize, 4096);
+		int decSize = _rac_d->decompressStripe(dstBuffer, cmpSize, decBuffer, srcSize);
+		EXPECT_EQ(decSize, srcSize);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer, decBuffer, srcSize ));
+	}
+	delete [] srcBuffer;
+	delete [] dstBuffer;
+	delete [] decBuffer;
+}
+
+TEST_F(CompressionTest, RACTestSampledTraining) {
+	int numberOfBlocks = 256;
+	int blockSize = 4096;
+	int srcSize = numberOfBlocks * blockSize;
+	char* srcBuffer = new char[srcSize];
+	for(int i = 0; i < srcSize; ++i) {
+		srcBuffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	int stripeCapacity = srcSize * 2;
+	char* dstBuffer = new char[stripeCapacity];
+	char* decBuffer = new char[srcSize];
+	CompressionParameter params = {blockSize, numberOfBlocks, 4096, 64, 8, LZ4Codec, 0, 1};
+	/* a quarter of the blocks by stride, then 16 blocks drawn at random */
+	for(int t = 0; t < 2; ++t) {
+		RACCompressor c(params);
+		TrainerParameter trainer = defaultTrainerParameter();
+		trainer.sample_fraction = 0.25;
+		trainer.sample_blocks = t == 0 ? 0 : 16;
+		trainer.sampling = t == 0 ? StrideSampling : RandomSampling;
+		c.setTrainerParameter(trainer);
+		int cmpSize = c.compressStripe(srcBuffer, srcSize, dstBuffer, stripeCapacity);
+		EXPECT_LT(cmpSize, srcSize);
+		int dictSize = 0;
+		memcpy(&dictSize, dstBuffer, sizeof(int));
+		EXPECT_GT(dictSize, 0);
+		int decSize = _rac_d->decompressStripe(dstBuffer, cmpSize, decBuffer, srcSize);
+		EXPECT_EQ(decSize, srcSize);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer, decBuffer, srcSize ));
+	}
+	/* no training fits in a microsecond: the stripe falls back to no dictionary, or to the one of the stripe before */
+	RACCompressor c(params);
+	int cmpSize = c.compressStripe(srcBuffer, srcSize, dstBuffer, stripeCapacity);
+	int previousDictSize = 0;
+	memcpy(&previousDictSize, dstBuffer, sizeof(int));
+	std::string previousDict(dstBuffer + sizeof(int), previousDictSize);
+	EXPECT_GT(previousDictSize, 0);
+	BudgetFallback fallbacks[2] = {PreviousDictionary, NoDictionary};
+	for(int t = 0; t < 2; ++t) {
+		TrainerParameter trainer = defaultTrainerParameter();
+		trainer.budget_ms = 0.001;
+		trainer.fallback = fallbacks[t];
+		c.setTrainerParameter(trainer);
+		gStats.collect();
+		long long int overruns = gStats.dict_budget_overruns;
+		long long int dictBytes = gStats.total_dictionary_size;
+		cmpSize = c.compressStripe(srcBuffer, srcSize, dstBuffer, stripeCapacity);
+		/* wait for the training given up on; its dictionary was not written, so it is not counted */
+		c.setTrainerParameter(trainer);
+		gStats.collect();
+		EXPECT_EQ(gStats.dict_budget_overruns - overruns, 1);
+		int dictSize = -1;
+		memcpy(&dictSize, dstBuffer, sizeof(int));
+		EXPECT_EQ(gStats.total_dictionary_size - dictBytes, dictSize);
+		if(fallbacks[t] == PreviousDictionary) {
+			EXPECT_EQ(dictSize, previousDictSize);
+			EXPECT_TRUE(previousDict == std::string(dstBuffer + sizeof(int), dictSize));
+		} else {
+			EXPECT_EQ(dictSize, 0);
+		}
+		int decSize = _rac_d->decompressStripe(dstBuffer, cmpSize, decBuffer, srcSize);
+		EXPECT_EQ(decSize, srcSize);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer, decBuffer, srcSize ));
+	}
+#if !MBC_COVER_CONCURRENT
+	/* while another training holds the COVER lock, a stripe falls back at once instead of waiting behind it */
+	TrainerParameter trainer = defaultTrainerParameter();
+	trainer.budget_ms = 60000;
+	c.setTrainerParameter(trainer);
+	{
+		std::lock_guard<std::mutex> guard(coverLock());
+		gStats.collect();
+		long long int overruns = gStats.dict_budget_overruns;
+		cmpSize = c.compressStripe(srcBuffer, srcSize, dstBuffer, stripeCapacity);
+		gStats.collect();
+		EXPECT_EQ(gStats.dict_budget_overruns - overruns, 1);
+	}
+	EXPECT_EQ(_rac_d->decompressStripe(dstBuffer, cmpSize, decBuffer, srcSize), srcSize);
+#endif
+	delete [] srcBuffer;
+	delete [] dstBuffer;
+	delete [] decBuffer;
+}
+
+TEST_F(CompressionTest, RACTestNativeKmer) {
+	/* the AVX2 and the scalar loop hash every d-mer size alike, including the tail the vector loop leaves over */
+	std::string bytes(1003, 0);
+	for(int i = 0; i < bytes.size(); ++i) {
+		bytes[i] = rand() % 256;
+	}
+	std::vector<uint32_t> hashes(bytes.size());
+	std::vector<uint32_t> scalarHashes(bytes.size());
+	for(int d = 1; d <= KMERDICT_MAX_KMER; ++d) {
+		KmerDictionaryBuilder builder(64, d);
+		builder.hash(bytes.data(), bytes.size(), hashes.data(), 16);
+		builder.hashScalar(bytes.data(), bytes.size(), scalarHashes.data(), 16);
+		EXPECT_TRUE(hashes == scalarHashes);
+	}
+
+	/* key-value records over a small vocabulary, in 4 KB blocks, against COVER with the same k and d */
+	int numberOfBlocks = 256;
+	int blockSize = 4096;
+	int srcSize = numberOfBlocks * blockSize;
+	const char* words[8] = {"timestamp", "customer", "warehouse", "shipment", "delivered", "pending", "priority", "region"};
+	std::string text;
+	while(text.size() < srcSize) {
+		text += std::string("{\"") + words[rand() % 8] + "\":\"" + words[rand() % 8] + "\",\"id\":" + std::to_string(rand() % 100000) + "}\n";
+	}
+	int stripeCapacity = srcSize * 2;
+	char* dstBuffer = new char[stripeCapacity];
+	char* decBuffer = new char[srcSize];
+	Codec codecs[2] = {LZ4Codec, ZSTDCodec};
+	for(int c = 0; c < 2; ++c) {
+		CompressionParameter params = {blockSize, numberOfBlocks, 4096, 64, 8, codecs[c], 0, 1};
+		Compressor* compressor = Compressor::create(RAC, params);
+		Decompressor* decompressor = Decompressor::create(RAC, params);
+		DictionaryAlgorithm algorithms[2] = {RollingKmer, NativeKmer};
+		int cmpSizes[2];
+		double stripeSeconds[2];
+		for(int a = 0; a < 2; ++a) {
+			/* timed here rather than with the dictionary timer, which a build without stats leaves at 0 */
+			std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+			cmpSizes[a] = compressor->compressStripe(text.data(), srcSize, dstBuffer, stripeCapacity, algorithms[a]);
+			std::chrono::steady_clock::time_point t_end = std::chrono::steady_clock::now();
+			stripeSeconds[a] = std::chrono::duration<double>(t_end - t_start).count();
+			int dictSize = 0;
+			memcpy(&dictSize, dstBuffer, sizeof(int));
+			EXPECT_GT(dictSize, 0);
+			EXPECT_LE(dictSize, 4096);
+			int decSize = decompressor->decompressStripe(dstBuffer, cmpSizes[a], decBuffer, srcSize);
+			EXPECT_EQ(decSize, srcSize);
+			EXPECT_TRUE(0 == std::memcmp( text.data(), decBuffer, srcSize ));
+		}
+		std::string codec = codecs[c] == LZ4Codec ? "lz4" : "zstd";
+		RecordProperty(codec + "_cover_bytes", cmpSizes[0]);
+		RecordProperty(codec + "_native_bytes", cmpSizes[1]);
+		/* the builder trades a little ratio for a much shorter training; the times, training included, are
+		 * reported rather than compared, as a loaded machine can swap them
+		 */
+		RecordProperty(codec + "_cover_us", (int) (stripeSeconds[0] * 1e6));
+		RecordProperty(codec + "_native_us", (int) (stripeSeconds[1] * 1e6));
+		EXPECT_LT(cmpSizes[1], cmpSizes[0] * 1.1);
+		delete compressor;
+		delete decompressor;
+	}
+	delete [] dstBuffer;
+	delete [] decBuffer;
+}
+
+TEST_F(CompressionTest, MBCTestPartialDecode) {
+	int numberOfBlocks = 64;
+	int blockSize = 4096;
+	int stripeSize = numberOfBlocks * blockSize;
+	CompressionParameter params = {blockSize, numberOfBlocks, 0, 0, 0};
+	MBCCompressor compressor(params);
+	MBCDecompressor decompressor(params);
+	char* srcBuffer = new char[stripeSize];
+	for(int i = 0; i < stripeSize; ++i) {
+		srcBuffer[i] = 'A'+rand()%4;
+	}
+	int dstCapacity = LZ4_compressBound(stripeSize);
+	char* dstBuffer = new char[dstCapacity];
+	int cmpSize = compressor.compressStripe(srcBuffer, stripeSize, dstBuffer, dstCapacity);
+	gStats.collect();
+	long long int decodes = gStats.mbc_block_decodes;
+	double fraction = gStats.mbc_decoded_fraction;
+	char* blkBuffer = new char[blockSize];
+	char* stripeBuffer = new char[stripeSize];
+	for(int blockIdx = 0; blockIdx < numberOfBlocks; ++blockIdx) {
+		int decodedSize = 0;
+		int decSize = decompressor.decompressBlock(dstBuffer, cmpSize, blkBuffer, blockSize, blockIdx, &decodedSize);
+		EXPECT_EQ(decSize, blockSize);
+		EXPECT_GE(decodedSize, (blockIdx + 1) * blockSize);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer + blockIdx * blockSize, blkBuffer, blockSize ));
+		char* oPtr = stripeBuffer;
+		decompressor.decompressBlock(dstBuffer, cmpSize, oPtr, stripeSize, blockIdx);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer + blockIdx * blockSize, oPtr, blockSize ));
+	}
+	gStats.collect();
+	EXPECT_EQ(gStats.mbc_block_decodes - decodes, 2 * numberOfBlocks);
+	/* reading every block once decodes (n+1)/2n of the stripe on average, about half */
+	double average = (gStats.mbc_decoded_fraction - fraction) / (2 * numberOfBlocks);
+	EXPECT_NEAR(average, (numberOfBlocks + 1.0) / (2 * numberOfBlocks), 0.05);
+	/* a truncated stripe cannot produce its last block */
+	char* oPtr = stripeBuffer;
+	EXPECT_LT(decompressor.decompressBlock(dstBuffer, cmpSize / 2, oPtr, stripeSize, numberOfBlocks - 1), 0);
+	delete [] srcBuffer;
+	delete [] dstBuffer;
+	delete [] blkBuffer;
+	delete [] stripeBuffer;
+}
+
+TEST(HistogramTest, TestPercentile) {
+	LatencyHistogram lower, upper, all;
+	for(long long int v = 1; v <= 100000; ++v) {
+		all.record(v);
+		if(v <= 50000) {
+			lower.record(v);
+		} else {
+			upper.record(v);
+		}
+	}
+	EXPECT_EQ(all.count(), 100000);
+	EXPECT_EQ(all.min(), 1);
+	EXPECT_EQ(all.max(), 100000);
+	EXPECT_EQ(all.percentile(100), 100000);
+	EXPECT_EQ(all.percentile(0.001), 1);
+	double ps[4] = {50, 90, 99, 99.9};
+	for(int i = 0; i < 4; ++i) {
+		double expected = ps[i] * 1000;
+		EXPECT_NEAR(all.percentile(ps[i]), expected, expected / HISTOGRAM_SUB_BUCKETS);
+	}
+	lower.merge(upper);
+	EXPECT_EQ(lower.count(), all.count());
+	EXPECT_EQ(lower.max(), all.max());
+	EXPECT_EQ(lower.percentile(99), all.percentile(99));
+}
+
+TEST(CodecTest, ZSTDTestRoundTrip) {
+	int blockSize = 4096;
+	int numberOfBlocks[3] = {1, 4, 256};
+	for(int n = 0; n < 3; ++n) {
+		CompressionParameter params = {blockSize, numberOfBlocks[n], n == 2 ? 4096 : 0, n == 2 ? 64 : 0, n == 2 ? 8 : 0, ZSTDCodec, 5};
+		CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+		Compressor* c = Compressor::create(algorithms[n], params);
+		Decompressor* d = Decompressor::create(algorithms[n], params);
+		/* a short tail block checks that RAC records raw sizes correctly */
+		int srcSize = numberOfBlocks[n] * blockSize - (n == 2 ? 100 : 0);
+		char* srcBuffer = new char[srcSize];
+		for(int i = 0; i < srcSize; ++i) {
+			srcBuffer[i] = i < srcSize/2 ? 'A'+rand()%4 : 'A'+(i/7)%13;
+		}
+		int capacity = srcSize * 2;
+		char* dstBuffer = new char[capacity];
+		int cmpSize = c->compressStripe(srcBuffer, srcSize, dstBuffer, capacity);
+		EXPECT_GT(cmpSize, 0);
+		EXPECT_LT(cmpSize, srcSize);
+		char* decBuffer = new char[srcSize];
+		int decSize = d->decompressStripe(dstBuffer, cmpSize, decBuffer, srcSize);
+		EXPECT_EQ(decSize, srcSize);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer, decBuffer, srcSize ));
+		/* the last block, decoded on its own */
+		int blockIdx = numberOfBlocks[n] - 1;
+		char* blkBuffer = new char[srcSize];
+		char* oPtr = blkBuffer;
+		int blkSize = d->decompressBlock(dstBuffer, cmpSize, oPtr, blockSize, blockIdx);
+		int expected = srcSize - blockIdx * blockSize;
+		EXPECT_EQ(blkSize, n == 1 ? blockSize : expected);
+		EXPECT_TRUE(0 == std::memcmp( srcBuffer + blockIdx * blockSize, oPtr, expected ));
+		delete [] srcBuffer;
+		delete [] dstBuffer;
+		delete [] decBuffer;
+		delete [] blkBuffer;
+		delete c;
+		delete d;
+	}
+}
+
+TEST(CodecTest, TestFactoryInstantiation) {
+	CompressionParameter lz4 = {4096, 256, 4096, 64, 8, LZ4Codec, 0};
+	CompressionParameter zstd = {4096, 256, 4096, 64, 8, ZSTDCodec, 3};
+	Compressor* c = Compressor::create(RAC, lz4);
+	Decompressor* d = Decompressor::create(RAC, lz4);
+	EXPECT_TRUE(dynamic_cast<RACCompressor*>(c) != NULL);
+	EXPECT_TRUE(dynamic_cast<RACDecompressor*>(d) != NULL);
+	delete c;
+	delete d;
+	c = Compressor::create(RAC, zstd);
+	d = Decompressor::create(RAC, zstd);
+	EXPECT_TRUE(dynamic_cast<ZSTDRACCompressor*>(c) != NULL);
+	EXPECT_TRUE(dynamic_cast<ZSTDRACDecompressor*>(d) != NULL);
+	EXPECT_TRUE(dynamic_cast<RACDecompressorBase*>(d) != NULL);
+	delete c;
+	delete d;
+	CompressionParameter mbc = {4096, 4, 0, 0, 0, ZSTDCodec, 3};
+	c = Compressor::create(MBC, mbc);
+	d = Decompressor::create(MBC, mbc);
+	EXPECT_TRUE(dynamic_cast<ZSTDMBCCompressor*>(c) != NULL);
+	EXPECT_TRUE(dynamic_cast<ZSTDMBCDecompressor*>(d) != NULL);
+	delete c;
+	delete d;
+	/* an unknown codec yields no compressor */
+	CompressionParameter unknown = {4096, 1, 0, 0, 0, (Codec) 7, 0};
+	EXPECT_TRUE(Compressor::create(SBC, unknown) == NULL);
+	EXPECT_TRUE(Decompressor::create(SBC, unknown) == NULL);
+}
+
+static void compressStripes(const char* src, int stripeSize, int nTimes) {
+	CompressionParameter params = {4096, 4, 0, 0, 0};
+	MBCCompressor compressor(params);
+	int capacity = LZ4_compressBound(stripeSize);
+	char* dst = new char[capacity];
+	for(int i = 0; i < nTimes; ++i) {
+		compressor.compressStripe(src, stripeSize, dst, capacity);
+	}
+	delete [] dst;
+}
+
+TEST(StatsTest, TestShardedCollect) {
+	gStats.collect();
+	long long int before = gStats.compress_stripe_histogram.count();
+	int stripeSize = 4096 * 4;
+	char* src = new char[stripeSize];
+	for(int i = 0; i < stripeSize; ++i) {
+		src[i] = 'A' + rand() % 4;
+	}
+	std::vector<std::thread> workers;
+	for(int t = 0; t < 4; ++t) {
+		workers.push_back(std::thread(compressStripes, src, stripeSize, 100));
+	}
+	for(int t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+	gStats.collect();
+#if MBC_ENABLE_STATS
+	// shards of the exited workers are folded in, none of their calls are lost
+	EXPECT_EQ(gStats.compress_stripe_histogram.count() - before, 400);
+	EXPECT_GT(gStats.compression_timer.count(), 0);
+#else
+	EXPECT_EQ(gStats.compress_stripe_histogram.count(), 0);
+#endif
+	delete [] src;
+}
+
 int main(int argc, char* argv[]) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -28,6 +28,39 @@ protected:
 	}
 };
 
+static std::string readWholeFile(std::string name) {
+	FILE* fp = fopen(name.c_str(), "rb");
+	fseek(fp, 0, SEEK_END);
+	long long int size = ftell(fp);
+	rewind(fp);
+	std::string content(size, '\0');
+	fread(&content[0], 1, size, fp);
+	fclose(fp);
+	return content;
+}
+
+// the dictionary size field of every stripe of the RAC file name, 0 for a stripe stored raw
+static std::vector<int> stripeDictionaryFields(std::string name) {
+	std::string out = readWholeFile(name);
+	int hdrSize = 0;
+	memcpy(&hdrSize, out.data(), sizeof(int));
+	int nStripes = 0;
+	const char* p = out.data() + sizeof(int) + 8 + sizeof(CompressionParameter);
+	memcpy(&nStripes, p, sizeof(int));
+	p += sizeof(int);
+	std::vector<int> fields;
+	for(int i = 0; i < nStripes; ++i) {
+		StripeHeader h;
+		memcpy(&h, p + i * sizeof(StripeHeader), sizeof(StripeHeader));
+		int dictField = 0;
+		if(h.compressedStripeSize < h.rawStripeSize) {
+			memcpy(&dictField, out.data() + sizeof(int) + hdrSize + h.offsetOfCompressedData, sizeof(int));
+		}
+		fields.push_back(dictField);
+	}
+	return fields;
+}
+
 TEST_F(FilerTest, TestMemcmp) {
 	long long int fileSize = 1024*1024*5;
 	char* buffer1 = new char[fileSize];
@@ -652,6 +685,870 @@ TEST_F(FilerTest, RACTestDecompressBlockSilesia) {
 	fcBuffer = NULL;
 }
 
+TEST_F(FilerTest, TestParallelCompressFile) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		if(i < fileSize/3) {
+			buffer[i] = 'A';
+		} else if(i < 2*fileSize/3) {
+			buffer[i] = 'A'+rand()%4;
+		} else {
+			buffer[i] = 'A'+rand()%26;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	delete [] buffer;
+	buffer = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fp_name = "test.par";
+	std::string fd_name = "test.dec";
+	Filer* filers[3] = {_sbc_filer, _mbc_filer, _rac_filer};
+	for(int n = 0; n < 3; ++n) {
+		filers[n]->setNumberOfThreads(1);
+		long long int serialSize = filers[n]->compressFile(fi_name, fo_name);
+		filers[n]->setNumberOfThreads(4);
+		long long int parallelSize = filers[n]->compressFile(fi_name, fp_name);
+		EXPECT_EQ(serialSize, parallelSize);
+		/* the parallel writer must produce exactly the same file as the serial one */
+		fp = fopen("test.out", "rb");
+		char* serialBuffer = new char[serialSize];
+		fread(serialBuffer, 1, serialSize, fp);
+		fclose(fp);
+		fp = fopen("test.par", "rb");
+		char* parallelBuffer = new char[parallelSize];
+		fread(parallelBuffer, 1, parallelSize, fp);
+		fclose(fp);
+		fp = NULL;
+		EXPECT_TRUE(0 == std::memcmp( serialBuffer, parallelBuffer, serialSize ));
+		delete [] serialBuffer;
+		delete [] parallelBuffer;
+		long long int decompressedSize = filers[n]->decompressFile(fp_name, fd_name);
+		EXPECT_EQ(decompressedSize, fileSize);
+	}
+}
+
+TEST_F(FilerTest, TestParallelDecompressFile) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		if(i < fileSize/3) {
+			buffer[i] = 'A';
+		} else if(i < 2*fileSize/3) {
+			buffer[i] = 'A'+rand()%4;
+		} else {
+			buffer[i] = 'A'+rand()%26;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	Filer* filers[3] = {_sbc_filer, _mbc_filer, _rac_filer};
+	char* dstBuffer = new char[fileSize];
+	for(int n = 0; n < 3; ++n) {
+		filers[n]->compressFile(fi_name, fo_name);
+		filers[n]->setNumberOfThreads(4);
+		long long int decompressedSize = filers[n]->decompressFile(fo_name, fd_name);
+		EXPECT_EQ(decompressedSize, fileSize);
+		fp = fopen("test.dec", "rb");
+		fseek(fp, 0, SEEK_END);
+		long long int dstSize = ftell(fp);
+		rewind(fp);
+		EXPECT_EQ(dstSize, fileSize);
+		fread(dstBuffer, 1, fileSize, fp);
+		fclose(fp);
+		fp = NULL;
+		EXPECT_TRUE(0 == std::memcmp( buffer, dstBuffer, fileSize ));
+	}
+	delete [] buffer;
+	delete [] dstBuffer;
+}
+
+TEST_F(FilerTest, TestMmapDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		if(i < fileSize/3) {
+			buffer[i] = 'A';
+		} else if(i < 2*fileSize/3) {
+			buffer[i] = 'A'+rand()%4;
+		} else {
+			buffer[i] = 'A'+rand()%26;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	int blockSize = 4096;
+	Filer* filers[3] = {_sbc_filer, _mbc_filer, _rac_filer};
+	char* decBuffer = new char[fileSize];
+	for(int n = 0; n < 3; ++n) {
+		filers[n]->compressFile(fi_name, fo_name);
+		filers[n]->setIOEngine(MmapEngine);
+		std::vector<int> blockIdxVec = filers[n]->decompressBlock(fo_name, fd_name);
+		EXPECT_EQ(blockIdxVec.size(), fileSize/blockSize);
+		fp = fopen("test.dec", "rb");
+		fseek(fp, 0, SEEK_END);
+		long long int decSize = ftell(fp);
+		rewind(fp);
+		EXPECT_EQ(decSize, fileSize);
+		fread(decBuffer, 1, decSize, fp);
+		fclose(fp);
+		fp = NULL;
+		for(int i = 0; i < blockIdxVec.size(); ++i) {
+			long long int offset = (long long int) blockIdxVec[i] * blockSize;
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, decBuffer + (long long int) i * blockSize, blockSize ));
+		}
+	}
+	delete [] buffer;
+	delete [] decBuffer;
+}
+
+TEST_F(FilerTest, TestConcurrentDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		if(i < fileSize/3) {
+			buffer[i] = 'A';
+		} else if(i < 2*fileSize/3) {
+			buffer[i] = 'A'+rand()%4;
+		} else {
+			buffer[i] = 'A'+rand()%26;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	delete [] buffer;
+	buffer = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	long long int totalBlockNumber = (fileSize-1)/4096+1;
+	Filer* filers[3] = {_sbc_filer, _mbc_filer, _rac_filer};
+	for(int n = 0; n < 3; ++n) {
+		filers[n]->compressFile(fi_name, fo_name);
+		filers[n]->setNumberOfThreads(4);
+		long long int readBytes = filers[n]->concurrentDecompressBlock(fo_name);
+		EXPECT_GT(readBytes, 0);
+		EXPECT_EQ(gStats.total_read_blocks, totalBlockNumber);
+		EXPECT_EQ(gStats.read_threads.size(), 4);
+		long long int reads = 0;
+		for(int t = 0; t < gStats.read_threads.size(); ++t) {
+			reads += gStats.read_threads[t].reads;
+			EXPECT_LE(gStats.read_threads[t].latency_max.count() * gStats.read_threads[t].reads, gStats.read_threads[t].latency_sum.count() * totalBlockNumber);
+		}
+		EXPECT_EQ(reads, totalBlockNumber);
+		EXPECT_GT(gStats.read_blocks_per_second(), 0);
+	}
+}
+
+TEST_F(FilerTest, TestOpenLoopDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	delete [] buffer;
+	buffer = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	long long int totalBlockNumber = (fileSize-1)/4096+1;
+	double qps = 20000;
+	Filer* filers[3] = {_sbc_filer, _mbc_filer, _rac_filer};
+	ArrivalProcess arrivals[3] = {ConstantArrival, PoissonArrival, ConstantArrival};
+	for(int n = 0; n < 3; ++n) {
+		filers[n]->compressFile(fi_name, fo_name);
+		filers[n]->setNumberOfThreads(2);
+		filers[n]->setLoadProfile(qps, arrivals[n]);
+		long long int readBytes = filers[n]->openLoopDecompressBlock(fo_name);
+		EXPECT_GT(readBytes, 0);
+		EXPECT_EQ(gStats.total_read_blocks, totalBlockNumber);
+		EXPECT_EQ(gStats.read_latency_histogram.count(), totalBlockNumber);
+		EXPECT_GT(gStats.read_latency_percentile(50), 0);
+		EXPECT_LE(gStats.read_latency_percentile(50), gStats.read_latency_percentile(90));
+		EXPECT_LE(gStats.read_latency_percentile(90), gStats.read_latency_percentile(99));
+		EXPECT_LE(gStats.read_latency_percentile(99), gStats.read_latency_percentile(99.9));
+		if(arrivals[n] == ConstantArrival) {
+			// the last request cannot be issued before its scheduled arrival
+			EXPECT_GE(gStats.read_wall_timer.count(), (totalBlockNumber-1) / qps);
+		}
+	}
+	/* reads of a RAC file whose stripes are zeroed fail; they still get a response time but are not blocks read */
+	std::string out = readWholeFile(fo_name);
+	int hdrSize = 0;
+	memcpy(&hdrSize, out.data(), sizeof(int));
+	std::fill(out.begin() + sizeof(int) + hdrSize, out.end(), '\0');
+	fp = fopen(fo_name.c_str(), "wb");
+	fwrite(out.data(), 1, out.size(), fp);
+	fclose(fp);
+	fp = NULL;
+	AccessParameter access = defaultAccessParameter();
+	access.number_of_reads = 20;
+	_rac_filer->setAccessPattern(access);
+	EXPECT_EQ(_rac_filer->openLoopDecompressBlock(fo_name), 0);
+	EXPECT_EQ(gStats.total_read_blocks, 0);
+	EXPECT_EQ(gStats.read_latency_histogram.count(), 20);
+	_rac_filer->setAccessPattern(defaultAccessParameter());
+}
+
+TEST_F(FilerTest, TestStripeCacheDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	delete [] buffer;
+	buffer = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	Filer* filers[2] = {_sbc_filer, _mbc_filer};
+	for(int n = 0; n < 2; ++n) {
+		filers[n]->compressFile(fi_name, fo_name);
+		srand(1);
+		filers[n]->decompressBlock(fo_name, fd_name);
+		std::string uncached = readWholeFile(fd_name);
+		double uncachedAmplification = gStats.decode_amplification();
+		EXPECT_EQ(gStats.cache_hits + gStats.cache_misses, 0);
+
+		/* a cache that holds every stripe misses once per distinct stripe */
+		long long int capacities[2] = {fileSize, 64*1024};
+		CachePolicy policies[2] = {LRUCache, FIFOCache};
+		for(int c = 0; c < 2; ++c) {
+			filers[n]->setStripeCache(capacities[c], policies[c]);
+			srand(1);
+			std::vector<int> blockIdxVec = filers[n]->decompressBlock(fo_name, fd_name);
+			EXPECT_TRUE(uncached == readWholeFile(fd_name));
+			EXPECT_EQ(gStats.cache_hits + gStats.cache_misses, blockIdxVec.size());
+			EXPECT_GT(gStats.cache_hits, 0);
+			if(c == 0) {
+				// a small cache decodes whole stripes and may decode more than partial MBC decoding does
+				EXPECT_LE(gStats.decode_amplification(), uncachedAmplification);
+			}
+		}
+		filers[n]->setStripeCache(0, LRUCache);
+	}
+}
+
+TEST_F(FilerTest, TestDictionaryCacheDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	delete [] buffer;
+	buffer = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	_rac_filer->compressFile(fi_name, fo_name);
+	srand(1);
+	_rac_filer->decompressBlock(fo_name, fd_name);
+	std::string uncached = readWholeFile(fd_name);
+	/* a dictionary plus 256 entries is about 7 KB, so the small cache holds a single stripe */
+	long long int capacities[2] = {1024*1024, 8*1024};
+	CachePolicy policies[2] = {LRUCache, FIFOCache};
+	for(int c = 0; c < 2; ++c) {
+		_rac_filer->setStripeCache(capacities[c], policies[c]);
+		srand(1);
+		std::vector<int> blockIdxVec = _rac_filer->decompressBlock(fo_name, fd_name);
+		EXPECT_TRUE(uncached == readWholeFile(fd_name));
+		// blocks of the 100-byte tail stripe are stored raw and never consult the cache
+		EXPECT_LE(gStats.cache_hits + gStats.cache_misses, blockIdxVec.size());
+		EXPECT_GT(gStats.cache_hits, 0);
+		if(c == 0) {
+			EXPECT_LE(gStats.cache_misses, (fileSize-1)/(4096*256)+1);
+		}
+	}
+	_rac_filer->setStripeCache(0, LRUCache);
+}
+
+TEST_F(FilerTest, TestPartialFetchDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	_rac_filer->compressFile(fi_name, fo_name);
+	IOEngine engines[3] = {StdioEngine, PreadEngine, MmapEngine};
+	for(int e = 0; e < 3; ++e) {
+		_rac_filer->setIOEngine(engines[e]);
+		srand(1);
+		std::vector<int> blockIdxVec = _rac_filer->decompressBlock(fo_name, fd_name);
+		std::string decoded = readWholeFile(fd_name);
+		long long int pos = 0;
+		for(int i = 0; i < blockIdxVec.size(); ++i) {
+			long long int offset = (long long int) blockIdxVec[i] * 4096;
+			int len = fileSize - offset < 4096 ? fileSize - offset : 4096;
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, decoded.data() + pos, len ));
+			pos += len;
+		}
+		EXPECT_EQ(pos, decoded.size());
+		/* a 4 KB read fetches the ~7 KB dictionary and entry table plus the block, not the whole 1 MB stripe */
+		EXPECT_LT(gStats.io_amplification(), 4);
+	}
+	_rac_filer->setStripeCache(1024*1024, LRUCache);
+	_rac_filer->decompressBlock(fo_name, fd_name);
+	EXPECT_LT(gStats.io_amplification(), 1.5);
+	_rac_filer->setStripeCache(0, LRUCache);
+	_rac_filer->setIOEngine(StdioEngine);
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestAccessPatternDecompressBlock) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*2+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	_mbc_filer->compressFile(fi_name, fo_name);
+	long long int nBlocks = (fileSize - 1) / 4096 + 1;
+
+	AccessParameter access = defaultAccessParameter();
+	access.distribution = SequentialAccess;
+	access.run_length = 8;
+	AccessPattern sequential(access, nBlocks);
+	long long int prev = sequential.next();
+	for(int i = 1; i < 8; ++i) {
+		long long int block = sequential.next();
+		EXPECT_EQ(block, (prev + 1) % nBlocks);
+		prev = block;
+	}
+	access.distribution = ZipfAccess;
+	AccessPattern zipf(access, nBlocks);
+	std::unordered_map<long long int, int> counts;
+	int maxCount = 0;
+	for(int i = 0; i < 10000; ++i) {
+		long long int block = zipf.next();
+		EXPECT_TRUE(block >= 0 && block < nBlocks);
+		maxCount = std::max(maxCount, ++counts[block]);
+	}
+	// the most popular block gets far more than the 10000 / nBlocks a uniform pattern would give it
+	EXPECT_GT(maxCount, 20 * 10000 / nBlocks);
+
+	/* the same seed replays the same reads, and warm-up reads are neither returned nor written */
+	access.number_of_reads = 100;
+	access.warmup_reads = 50;
+	_mbc_filer->setAccessPattern(access);
+	std::vector<int> first = _mbc_filer->decompressBlock(fo_name, fd_name);
+	std::vector<int> second = _mbc_filer->decompressBlock(fo_name, fd_name);
+	EXPECT_EQ(first.size(), 100);
+	EXPECT_TRUE(first == second);
+	std::string decoded = readWholeFile(fd_name);
+	long long int pos = 0;
+	for(int i = 0; i < second.size(); ++i) {
+		long long int offset = (long long int) second[i] * 4096;
+		int len = fileSize - offset < 4096 ? fileSize - offset : 4096;
+		EXPECT_TRUE(0 == std::memcmp( buffer + offset, decoded.data() + pos, len ));
+		pos += len;
+	}
+	EXPECT_EQ(pos, decoded.size());
+	EXPECT_EQ(gStats.total_served_bytes, pos);
+	_mbc_filer->setAccessPattern(defaultAccessParameter());
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestReplayTrace) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*2+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	delete [] buffer;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	_rac_filer->compressFile(fi_name, fo_name);
+
+	/* byte ranges: unaligned, spanning two stripes, and running past the end of the file; an empty one is skipped */
+	fp = fopen("test.trace", "w");
+	fprintf(fp, "# timestamp offset length\n");
+	fprintf(fp, "0.000 100 50\n");
+	fprintf(fp, "0.005 200 0\n");
+	fprintf(fp, "0.010,1048000,1000\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "0.020 %lld 4096\n", fileSize - 10);
+	fclose(fp);
+	_rac_filer->setTrace("test.trace", ByteTrace, FastReplay);
+	EXPECT_EQ(_rac_filer->replayTrace(fo_name), 50 + 1000 + 10);
+	EXPECT_EQ(gStats.total_read_blocks, 1 + 2 + 1);
+	EXPECT_EQ(gStats.read_latency_histogram.count(), 3);
+
+	/* block numbers, with the length defaulting to one block, played at their timestamps */
+	fp = fopen("test.trace", "w");
+	fprintf(fp, "5.00 0\n5.02 3 2\n5.05 300\n");
+	fclose(fp);
+	_rac_filer->setTrace("test.trace", BlockTrace, TimedReplay);
+	EXPECT_EQ(_rac_filer->replayTrace(fo_name), 4096 * 4);
+	EXPECT_GE(gStats.read_wall_timer.count(), 0.05);
+	EXPECT_EQ(gStats.read_latency_histogram.count(), 3);
+
+	_rac_filer->setTrace("test.missing", ByteTrace, FastReplay);
+	EXPECT_EQ(_rac_filer->replayTrace(fo_name), -1);
+}
+
+TEST_F(FilerTest, ZSTDTestFile) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*2+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = 'A'+rand()%4;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+	int numberOfBlocks[3] = {1, 4, 256};
+	for(int n = 0; n < 3; ++n) {
+		GlobalParams params;
+		params.algorithm = algorithms[n];
+		params.codec = ZSTDCodec;
+		params.level = 3;
+		params.acceleration = 1;
+		params.block_size = 4096;
+		params.number_of_blocks = numberOfBlocks[n];
+		params.max_dict = n == 2 ? 4096 : 0;
+		params.segment_size = n == 2 ? 64 : 0;
+		params.kmer_size = n == 2 ? 8 : 0;
+		params.workload = SequentialWrite;
+		params.dictionary_algorithm = RollingKmer;
+		params.shared_dictionaries = 0;
+		params.dictionary_drift = 0;
+		params.dictionary_dedup = false;
+		params.trainer = defaultTrainerParameter();
+		params.number_of_threads = 2;
+		params.io_engine = StdioEngine;
+		params.target_qps = 0;
+		params.arrival = PoissonArrival;
+		params.cache_size = 0;
+		params.cache_policy = LRUCache;
+		params.access = defaultAccessParameter();
+		params.trace_unit = ByteTrace;
+		params.replay_mode = FastReplay;
+		Filer filer;
+		filer.init(params);
+		filer.compressFile(fi_name, fo_name);
+		EXPECT_LT(gStats.total_compressed_size, fileSize / 2);
+		filer.decompressFile(fo_name, fd_name);
+		EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+		if(algorithms[n] == MBC) {
+			/* zstd cannot stop early, so every MBC block read decodes its whole stripe */
+			filer.decompressBlock(fo_name, fd_name);
+			EXPECT_GT(gStats.decode_amplification(), numberOfBlocks[n] - 0.5);
+		}
+		/* the codec is recorded in the header, so a reader needs no configuration */
+		CompressedFileReader reader;
+		EXPECT_TRUE(reader.open(fo_name));
+		EXPECT_EQ(reader.getParams().codec, ZSTDCodec);
+		char* dst = new char[5000];
+		EXPECT_EQ(reader.readRange(fileSize - 5000, 5000, dst), 5000);
+		EXPECT_TRUE(0 == std::memcmp( buffer + fileSize - 5000, dst, 5000 ));
+		delete [] dst;
+	}
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, LZ4HCAndAccelerationTestFile) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = i % 3000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	CompressionAlgorithm algorithms[2] = {MBC, RAC};
+	int numberOfBlocks[2] = {4, 256};
+	/* lz4hc level 9, lz4 at the default acceleration, lz4 at acceleration 32 */
+	Codec codecs[3] = {LZ4HCCodec, LZ4Codec, LZ4Codec};
+	int levels[3] = {9, 0, 0};
+	int accelerations[3] = {1, 1, 32};
+	for(int n = 0; n < 2; ++n) {
+		long long int sizes[3];
+		for(int c = 0; c < 3; ++c) {
+			GlobalParams params;
+			params.algorithm = algorithms[n];
+			params.codec = codecs[c];
+			params.level = levels[c];
+			params.acceleration = accelerations[c];
+			params.block_size = 4096;
+			params.number_of_blocks = numberOfBlocks[n];
+			params.max_dict = n == 1 ? 4096 : 0;
+			params.segment_size = n == 1 ? 64 : 0;
+			params.kmer_size = n == 1 ? 8 : 0;
+			params.workload = SequentialWrite;
+			params.dictionary_algorithm = RollingKmer;
+			params.shared_dictionaries = 0;
+			params.dictionary_drift = 0;
+			params.dictionary_dedup = false;
+			params.trainer = defaultTrainerParameter();
+			params.number_of_threads = 1;
+			params.io_engine = StdioEngine;
+			params.target_qps = 0;
+			params.arrival = PoissonArrival;
+			params.cache_size = 0;
+			params.cache_policy = LRUCache;
+			params.access = defaultAccessParameter();
+			params.trace_unit = ByteTrace;
+			params.replay_mode = FastReplay;
+			Filer filer;
+			filer.init(params);
+			filer.compressFile(fi_name, fo_name);
+			sizes[c] = gStats.total_compressed_size;
+			filer.decompressFile(fo_name, fd_name);
+			EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+			/* the setting is recorded in the header */
+			CompressedFileReader reader;
+			EXPECT_TRUE(reader.open(fo_name));
+			EXPECT_EQ(reader.getParams().codec, codecs[c]);
+			EXPECT_EQ(reader.getParams().level, levels[c]);
+			EXPECT_EQ(reader.getParams().acceleration, accelerations[c]);
+			char* dst = new char[5000];
+			EXPECT_EQ(reader.readRange(fileSize / 2, 5000, dst), 5000);
+			EXPECT_TRUE(0 == std::memcmp( buffer + fileSize / 2, dst, 5000 ));
+			delete [] dst;
+		}
+		EXPECT_LT(sizes[0], sizes[1]);
+		EXPECT_LT(sizes[1], sizes[2]);
+	}
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestDictionaryDedupFile) {
+	FILE* fp = fopen("test.in", "wb");
+	int stripeSize = 4096*256;
+	long long int fileSize = (long long int) stripeSize*5+100;
+	char* buffer = new char[fileSize];
+	/* five identical stripes train five identical dictionaries */
+	for(int i = 0; i < stripeSize; ++i) {
+		buffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	for(long long int i = stripeSize; i < fileSize; ++i) {
+		buffer[i] = buffer[i % stripeSize];
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	/* off by default: every stripe keeps its own dictionary */
+	long long int selfContainedSize = _rac_filer->compressFile(fi_name, fo_name);
+	gStats.collect();
+	EXPECT_EQ(gStats.total_deduplicated_dictionary_size, 0);
+	EXPECT_EQ(_rac_filer->decompressFile(fo_name, fd_name), fileSize);
+	EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+	_rac_filer->setDictionaryDedup(true);
+	for(int nThreads = 1; nThreads <= 2; ++nThreads) {
+		_rac_filer->setNumberOfThreads(nThreads);
+		gStats.collect();
+		long long int dictBytes = gStats.total_dictionary_size;
+		long long int dedupSize = _rac_filer->compressFile(fi_name, fo_name);
+		gStats.collect();
+		EXPECT_LT(dedupSize, selfContainedSize);
+		/* all but the first copy are left out */
+		EXPECT_GT(gStats.total_deduplicated_dictionary_size, 0);
+		EXPECT_GE(5 * gStats.total_deduplicated_dictionary_size, 3 * (gStats.total_dictionary_size - dictBytes));
+		EXPECT_EQ(_rac_filer->decompressFile(fo_name, fd_name), fileSize);
+		EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+		std::vector<int> blockIdxVec = _rac_filer->decompressBlock(fo_name, fd_name);
+		std::string decoded = readWholeFile(fd_name);
+		long long int pos = 0;
+		for(int i = 0; i < blockIdxVec.size(); ++i) {
+			long long int offset = (long long int) blockIdxVec[i] * 4096;
+			int len = fileSize - offset < 4096 ? fileSize - offset : 4096;
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, decoded.data() + pos, len ));
+			pos += len;
+		}
+		EXPECT_EQ(pos, decoded.size());
+		CompressedFileReader reader;
+		/* pread and mmap both fetch the dictionaries after the payload on first use */
+		EXPECT_TRUE(reader.open(fo_name, nThreads == 1 ? PreadEngine : MmapEngine));
+		char* dst = new char[3*4096];
+		for(long long int offset = 1000; offset < fileSize; offset += fileSize / 7) {
+			long long int len = fileSize - offset < 3*4096 ? fileSize - offset : 3*4096;
+			EXPECT_EQ(reader.readRange(offset, 3*4096, dst), len);
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, dst, len ));
+		}
+		delete [] dst;
+	}
+	_rac_filer->setDictionaryDedup(false);
+	_rac_filer->setNumberOfThreads(1);
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestDictionaryDriftFile) {
+	FILE* fp = fopen("test.in", "wb");
+	int stripeSize = 4096*256;
+	long long int fileSize = (long long int) stripeSize*6+100;
+	char* buffer = new char[fileSize];
+	/* the data changes its nature after three stripes */
+	for(long long int i = 0; i < fileSize; ++i) {
+		if(i < 3 * stripeSize) {
+			buffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+		} else {
+			buffer[i] = i % 3000 < 1500 ? '0'+rand()%10 : 'A'+(i/3)%23;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	long long int baseline = _rac_filer->compressFile(fi_name, fo_name);
+	_rac_filer->setDictionaryDrift(0.1);
+	for(int nThreads = 1; nThreads <= 2; ++nThreads) {
+		_rac_filer->setNumberOfThreads(nThreads);
+		gStats.collect();
+		long long int reused = gStats.dict_reused_stripes;
+		long long int retrained = gStats.dict_retrained_stripes;
+		long long int dictBytes = gStats.total_dictionary_size;
+		long long int cmpSize = _rac_filer->compressFile(fi_name, fo_name);
+		gStats.collect();
+		reused = gStats.dict_reused_stripes - reused;
+		retrained = gStats.dict_retrained_stripes - retrained;
+		EXPECT_EQ(reused + retrained, 7);
+		/* reused dictionaries are stored again in every stripe, and so counted again */
+		std::vector<int> dictFields = stripeDictionaryFields(fo_name);
+		long long int storedDictBytes = 0;
+		for(int i = 0; i < dictFields.size(); ++i) {
+			storedDictBytes += dictFields[i];
+		}
+		EXPECT_EQ(gStats.total_dictionary_size - dictBytes, storedDictBytes);
+		if(nThreads == 1) {
+			/* one dictionary per kind of data and one for the short tail */
+			EXPECT_GE(reused, 3);
+			EXPECT_GE(retrained, 2);
+		}
+		EXPECT_LT(cmpSize, baseline * 1.05);
+		EXPECT_EQ(_rac_filer->decompressFile(fo_name, fd_name), fileSize);
+		EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+		CompressedFileReader reader;
+		EXPECT_TRUE(reader.open(fo_name));
+		char* dst = new char[3*4096];
+		for(long long int offset = 1000; offset < fileSize; offset += fileSize / 7) {
+			long long int len = fileSize - offset < 3*4096 ? fileSize - offset : 3*4096;
+			EXPECT_EQ(reader.readRange(offset, 3*4096, dst), len);
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, dst, len ));
+		}
+		delete [] dst;
+	}
+	_rac_filer->setDictionaryDrift(0);
+	_rac_filer->setNumberOfThreads(1);
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestParallelDictionaryDriftFile) {
+	FILE* fp = fopen("test.in", "wb");
+	int stripeSize = 4096*16;
+	long long int fileSize = (long long int) stripeSize*50+100;
+	char* buffer = new char[fileSize];
+	/* the data changes its nature every ten stripes, so runs both reuse and retrain dictionaries */
+	for(long long int i = 0; i < fileSize; ++i) {
+		if(i / (10 * stripeSize) % 2 == 0) {
+			buffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+		} else {
+			buffer[i] = i % 3000 < 1500 ? '0'+rand()%10 : 'A'+(i/3)%23;
+		}
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fp_name = "test.par";
+	std::string fd_name = "test.dec";
+	GlobalParams params;
+	params.algorithm = RAC;
+	params.codec = LZ4Codec;
+	params.level = 0;
+	params.acceleration = 1;
+	params.block_size = 4096;
+	params.number_of_blocks = 16;
+	params.max_dict = 4096;
+	params.segment_size = 64;
+	params.kmer_size = 8;
+	params.workload = SequentialWrite;
+	params.dictionary_algorithm = RollingKmer;
+	params.shared_dictionaries = 0;
+	params.dictionary_drift = 0.1;
+	params.dictionary_dedup = false;
+	params.trainer = defaultTrainerParameter();
+	params.number_of_threads = 1;
+	params.io_engine = StdioEngine;
+	params.target_qps = 0;
+	params.arrival = PoissonArrival;
+	params.cache_size = 0;
+	params.cache_policy = LRUCache;
+	params.access = defaultAccessParameter();
+	params.trace_unit = ByteTrace;
+	params.replay_mode = FastReplay;
+	Filer filer;
+	filer.init(params);
+	gStats.collect();
+	long long int reused = gStats.dict_reused_stripes;
+	long long int serialSize = filer.compressFile(fi_name, fo_name);
+	gStats.collect();
+	EXPECT_GT(gStats.dict_reused_stripes - reused, 0);
+	/* each thread compresses whole runs, so the stripes reuse the same dictionaries as with one thread */
+	filer.setNumberOfThreads(4);
+	long long int parallelSize = filer.compressFile(fi_name, fp_name);
+	EXPECT_EQ(serialSize, parallelSize);
+	EXPECT_TRUE(readWholeFile(fo_name) == readWholeFile(fp_name));
+	EXPECT_EQ(filer.decompressFile(fp_name, fd_name), fileSize);
+	EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestBudgetFallbackFile) {
+	FILE* fp = fopen("test.in", "wb");
+	int stripeSize = 4096*256;
+	long long int fileSize = (long long int) stripeSize*24+100;
+	char* buffer = new char[fileSize];
+	for(long long int i = 0; i < fileSize; ++i) {
+		buffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	/* every training overruns the budget and one-stripe runs start at every stripe, so each stripe falls back
+	 * on the last dictionary that arrived, late, for an earlier stripe; none may fall back to no dictionary
+	 * once there is one
+	 */
+	TrainerParameter trainer = defaultTrainerParameter();
+	trainer.budget_ms = 0.001;
+	trainer.fallback = PreviousDictionary;
+	trainer.sample_blocks = 16;
+	_rac_filer->setTrainerParameter(trainer);
+	gStats.collect();
+	long long int overruns = gStats.dict_budget_overruns;
+	_rac_filer->compressFile(fi_name, fo_name);
+	gStats.collect();
+	// training on the 100-byte tail may beat even this budget
+	EXPECT_GE(gStats.dict_budget_overruns - overruns, 24);
+	std::vector<int> dictFields = stripeDictionaryFields(fo_name);
+	EXPECT_EQ(dictFields.size(), 25);
+	/* the 100-byte tail is stored raw */
+	bool hadDictionary = false;
+	for(int i = 0; i < 24; ++i) {
+		if(hadDictionary) {
+			EXPECT_GT(dictFields[i], 0);
+		}
+		hadDictionary = hadDictionary || dictFields[i] > 0;
+	}
+	EXPECT_EQ(_rac_filer->decompressFile(fo_name, fd_name), fileSize);
+	EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+	_rac_filer->setTrainerParameter(defaultTrainerParameter());
+	delete [] buffer;
+}
+
+TEST_F(FilerTest, TestSharedDictionaryFile) {
+	FILE* fp = fopen("test.in", "wb");
+	long long int fileSize = 1024*1024*5+100;
+	char* buffer = new char[fileSize];
+	for(int i = 0; i < fileSize; ++i) {
+		buffer[i] = i % 4000 < 1000 ? 'A'+rand()%4 : 'a'+(i/5)%17;
+	}
+	fwrite(buffer, 1, fileSize, fp);
+	fclose(fp);
+	fp = NULL;
+	std::string fi_name = "test.in";
+	std::string fo_name = "test.out";
+	std::string fd_name = "test.dec";
+	gStats.collect();
+	long long int dictBytes = gStats.total_dictionary_size;
+	_rac_filer->compressFile(fi_name, fo_name);
+	gStats.collect();
+	long long int perStripeDictBytes = gStats.total_dictionary_size - dictBytes;
+	_rac_filer->setSharedDictionaries(2);
+	for(int nThreads = 1; nThreads <= 2; ++nThreads) {
+		_rac_filer->setNumberOfThreads(nThreads);
+		dictBytes = gStats.total_dictionary_size;
+		_rac_filer->compressFile(fi_name, fo_name);
+		gStats.collect();
+		/* two dictionaries in the header instead of one per stripe; on this short uniform file a dictionary trained
+		 * on its own stripe still fits it a little better, so the file sizes are not compared */
+		EXPECT_LE(gStats.total_dictionary_size - dictBytes, 2 * RAC_MAX_DICT);
+		EXPECT_LT(gStats.total_dictionary_size - dictBytes, perStripeDictBytes / 2);
+		EXPECT_EQ(_rac_filer->decompressFile(fo_name, fd_name), fileSize);
+		EXPECT_TRUE(std::string(buffer, fileSize) == readWholeFile(fd_name));
+		std::vector<int> blockIdxVec = _rac_filer->decompressBlock(fo_name, fd_name);
+		std::string decoded = readWholeFile(fd_name);
+		long long int pos = 0;
+		for(int i = 0; i < blockIdxVec.size(); ++i) {
+			long long int offset = (long long int) blockIdxVec[i] * 4096;
+			int len = fileSize - offset < 4096 ? fileSize - offset : 4096;
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, decoded.data() + pos, len ));
+			pos += len;
+		}
+		EXPECT_EQ(pos, decoded.size());
+		CompressedFileReader reader;
+		EXPECT_TRUE(reader.open(fo_name));
+		char* dst = new char[3*4096];
+		for(long long int offset = 1000; offset < fileSize; offset += fileSize / 7) {
+			long long int len = fileSize - offset < 3*4096 ? fileSize - offset : 3*4096;
+			EXPECT_EQ(reader.readRange(offset, 3*4096, dst), len);
+			EXPECT_TRUE(0 == std::memcmp( buffer + offset, dst, len ));
+		}
+		delete [] dst;
+	}
+	_rac_filer->setSharedDictionaries(0);
+	_rac_filer->setNumberOfThreads(1);
+	delete [] buffer;
+}
+
 int main(int argc, char* argv[]) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
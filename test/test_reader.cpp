@@ -0,0 +1,164 @@
+#include <thread>
+#include "common.h"
+#include "filer.hpp"
+#include "reader.hpp"
+#include "gtest/gtest.h"
+
+ZZStats gStats;
+
+class ReaderTest : public ::testing::Test {
+protected:
+	long long int _file_size;
+	char* _buffer;
+
+	virtual void SetUp() {
+		_file_size = 1024*1024*5+100;
+		_buffer = new char[_file_size];
+		for(long long int i = 0; i < _file_size; ++i) {
+			if(i < _file_size/3) {
+				_buffer[i] = 'A';
+			} else if(i < 2*_file_size/3) {
+				_buffer[i] = 'A'+rand()%4;
+			} else {
+				_buffer[i] = 'A'+rand()%26;
+			}
+		}
+		FILE* fp = fopen("reader.in", "wb");
+		fwrite(_buffer, 1, _file_size, fp);
+		fclose(fp);
+	}
+
+	virtual void TearDown() {
+		delete [] _buffer;
+		_buffer = NULL;
+	}
+
+	void compress(CompressionAlgorithm algorithm) {
+		Filer filer(algorithm);
+		filer.compressFile("reader.in", "reader.out");
+	}
+
+	// read every block of reader.out through the reader and compare it with the raw input
+	void readAll(CompressedFileReader& reader) {
+		int blockSize = reader.getParams().block_size;
+		char* blkBuffer = new char[blockSize];
+		for(long long int i = 0; i < reader.getNumberOfBlocks(); ++i) {
+			int decSize = reader.readBlock(i, blkBuffer);
+			long long int offset = i * blockSize;
+			int expected = _file_size - offset < blockSize ? _file_size - offset : blockSize;
+			EXPECT_EQ(decSize, expected);
+			EXPECT_TRUE(0 == std::memcmp( _buffer + offset, blkBuffer, expected ));
+		}
+		delete [] blkBuffer;
+	}
+};
+
+TEST_F(ReaderTest, TestReadBlock) {
+	CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+	IOEngine engines[2] = {PreadEngine, MmapEngine};
+	for(int n = 0; n < 3; ++n) {
+		compress(algorithms[n]);
+		for(int e = 0; e < 2; ++e) {
+			CompressedFileReader reader;
+			EXPECT_TRUE(reader.open("reader.out", engines[e]));
+			EXPECT_EQ(reader.getAlgorithm(), algorithms[n]);
+			EXPECT_EQ(reader.getNumberOfBlocks(), (_file_size-1)/4096+1);
+			readAll(reader);
+		}
+	}
+}
+
+TEST_F(ReaderTest, TestConcurrentReadBlock) {
+	CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+	for(int n = 0; n < 3; ++n) {
+		compress(algorithms[n]);
+		CompressedFileReader reader;
+		EXPECT_TRUE(reader.open("reader.out"));
+		int nThreads = 4;
+		std::vector<int> mismatches(nThreads, 0);
+		std::vector<std::thread> workers;
+		for(int t = 0; t < nThreads; ++t) {
+			workers.push_back(std::thread([&reader, &mismatches, t, this]() {
+				int blockSize = reader.getParams().block_size;
+				char* blkBuffer = new char[blockSize];
+				for(int i = 0; i < 1000; ++i) {
+					long long int blockNumber = (i * 7919LL + t * 104729LL) % reader.getNumberOfBlocks();
+					int decSize = reader.readBlock(blockNumber, blkBuffer);
+					long long int offset = blockNumber * blockSize;
+					int expected = _file_size - offset < blockSize ? _file_size - offset : blockSize;
+					if(decSize != expected || 0 != std::memcmp( _buffer + offset, blkBuffer, expected )) {
+						mismatches[t]++;
+					}
+				}
+				delete [] blkBuffer;
+			}));
+		}
+		for(int t = 0; t < nThreads; ++t) {
+			workers[t].join();
+			EXPECT_EQ(mismatches[t], 0);
+		}
+	}
+}
+
+TEST_F(ReaderTest, TestReadBlocks) {
+	CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+	for(int n = 0; n < 3; ++n) {
+		compress(algorithms[n]);
+		CompressedFileReader reader;
+		EXPECT_TRUE(reader.open("reader.out"));
+		int blockSize = reader.getParams().block_size;
+		long long int nBlocks = reader.getNumberOfBlocks();
+		/* unsorted requests with neighbours in one stripe, duplicates, the tail block and one invalid index */
+		std::vector<long long int> idxs;
+		for(int i = 0; i < 200; ++i) {
+			idxs.push_back((i * 7919LL) % nBlocks);
+			idxs.push_back((i * 7919LL + 1) % nBlocks);
+		}
+		idxs.push_back(idxs[0]);
+		idxs.push_back(nBlocks-1);
+		idxs.push_back(nBlocks);
+		char* dst = new char[idxs.size() * blockSize];
+		std::vector<int> sizes;
+		int nRead = reader.readBlocks(idxs, dst, sizes);
+		EXPECT_EQ(nRead, idxs.size()-1);
+		EXPECT_EQ(sizes.size(), idxs.size());
+		EXPECT_EQ(sizes.back(), -1);
+		for(int i = 0; i+1 < idxs.size(); ++i) {
+			long long int offset = idxs[i] * blockSize;
+			int expected = _file_size - offset < blockSize ? _file_size - offset : blockSize;
+			EXPECT_EQ(sizes[i], expected);
+			EXPECT_TRUE(0 == std::memcmp( _buffer + offset, dst + (long long int) i * blockSize, expected ));
+		}
+		delete [] dst;
+	}
+}
+
+TEST_F(ReaderTest, TestReadRange) {
+	CompressionAlgorithm algorithms[3] = {SBC, MBC, RAC};
+	IOEngine engines[2] = {PreadEngine, MmapEngine};
+	for(int n = 0; n < 3; ++n) {
+		compress(algorithms[n]);
+		for(int e = 0; e < 2; ++e) {
+			CompressedFileReader reader;
+			EXPECT_TRUE(reader.open("reader.out", engines[e]));
+			EXPECT_EQ(reader.getRawSize(), _file_size);
+			/* unaligned heads and tails, ranges inside one block, across blocks and stripes, and past the end */
+			long long int offsets[7] = {0, 1, 4095, 100000, 1024*1024-10, _file_size-50, 0};
+			long long int lengths[7] = {1, 4096, 2, 3*4096+17, 4096*5, 4096, _file_size};
+			char* dst = new char[_file_size];
+			for(int i = 0; i < 7; ++i) {
+				long long int expected = _file_size - offsets[i] < lengths[i] ? _file_size - offsets[i] : lengths[i];
+				EXPECT_EQ(reader.readRange(offsets[i], lengths[i], dst), expected);
+				EXPECT_TRUE(0 == std::memcmp( _buffer + offsets[i], dst, expected ));
+			}
+			EXPECT_EQ(reader.readRange(_file_size, 10, dst), 0);
+			EXPECT_EQ(reader.readRange(_file_size+1, 10, dst), -1);
+			delete [] dst;
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}